@@ -37,32 +37,34 @@
 #include <libcommon.h>
 #include <ieee802154.h>
 #include <logging.h>
+#include <addrdb.h>
+#include <probes.h>
 
 struct lease {
 	uint8_t hwaddr[IEEE802154_ADDR_LEN];
 	uint16_t short_addr;
+	/* Reserved, but not announced until addrdb_commit() */
+	uint8_t pending;
+	/* Addresses owned, its own included: more than 1 for tree routers */
+	uint16_t block;
 	time_t time;
 };
 
 static struct simple_hash *hwa_hash;
 static struct simple_hash *shorta_hash;
+static addrdb_notify_t notify;
+/* Committed leases only, like the walks */
+static unsigned int lease_count;
 
-static unsigned int hw_hash(const void *key)
+static void addrdb_notify(enum addrdb_event ev, struct lease *lease)
 {
-	const uint8_t *hwa = key;
-	int i;
-	unsigned int val = 0;
-
-	for (i = 0; i < IEEE802154_ADDR_LEN; i++) {
-		val = (val * 31) | hwa[i];
-	}
-
-	return val;
+	if (notify)
+		notify(ev, lease->hwaddr, lease->short_addr, lease->time);
 }
 
-static int hw_eq(const void *key1, const void *key2)
+void addrdb_set_notify(addrdb_notify_t fn)
 {
-	return memcmp(key1, key2, IEEE802154_ADDR_LEN);
+	notify = fn;
 }
 
 static unsigned int short_hash(const void *key)
@@ -80,29 +82,180 @@ static int short_eq(const void *key1, const void *key2)
 
 static uint16_t last_addr;
 static uint16_t range_min, range_max;
-uint16_t addrdb_alloc(uint8_t *hwa)
+
+/*
+ * Tree mode, off while tree_cm is 0. The range starts with tree_rm
+ * router blocks of tree_cskip addresses each, followed by one address
+ * for each of the other tree_cm - tree_rm children.
+ */
+static unsigned int tree_cm, tree_rm, tree_cskip;
+
+/* Where a lease may stay; anything else is moved when its owner rejoins */
+static int addrdb_in_range(uint16_t addr)
+{
+	unsigned int off = addr - range_min;
+
+	if (addr < range_min || addr > range_max)
+		return 0;
+	if (!tree_cm)
+		return 1;
+	if (off < tree_rm * tree_cskip)
+		return off % tree_cskip == 0;
+
+	return off - tree_rm * tree_cskip < tree_cm - tree_rm;
+}
+
+/* Size of the block that comes with addr */
+static uint16_t addrdb_tree_block(uint16_t addr)
+{
+	unsigned int off = addr - range_min;
+
+	if (tree_cm && addr >= range_min && off < tree_rm * tree_cskip &&
+	    off % tree_cskip == 0)
+		return tree_cskip;
+
+	return 1;
+}
+
+/*
+ * Cskip(0): a router at depth 1 may have up to cm children, rm of them
+ * routers, which again get a block of their own, down to depth lm.
+ */
+static unsigned long addrdb_cskip(unsigned int cm, unsigned int rm, unsigned int lm)
+{
+	unsigned long pow = 1;
+	unsigned int i;
+
+	if (rm <= 1)
+		return 1 + (unsigned long)cm * (lm - 1) * rm;
+
+	for (i = 0; i < lm - 1; i++) {
+		pow *= rm;
+		if (pow > 0x10000)
+			return 0x10000;
+	}
+
+	return (cm * pow - 1 - cm + rm) / (rm - 1);
+}
+
+int addrdb_set_tree(unsigned int cm, unsigned int rm, unsigned int lm)
+{
+	unsigned long cskip;
+
+	if (!cm) {
+		tree_cm = 0;
+		return 0;
+	}
+	if (rm > cm || !lm)
+		return -1;
+
+	cskip = addrdb_cskip(cm, rm, lm);
+	if (cskip * rm + (cm - rm) > (unsigned long)range_max - range_min + 1)
+		return -1;
+
+	tree_cm = cm;
+	tree_rm = rm;
+	tree_cskip = cskip;
+	log_msg(0, "Tree of %u children, %u routers, depth %u: blocks of %lu\n",
+			cm, rm, lm, cskip);
+
+	return 0;
+}
+
+/*
+ * A router gets the first free router block. Once they are all taken,
+ * routers join like end devices and have no children of their own.
+ */
+static int addrdb_tree_find(int router, uint16_t *res, unsigned int *probes)
+{
+	uint16_t addr;
+	unsigned int i;
+
+	for (i = 0; router && i < tree_rm; i++) {
+		addr = range_min + i * tree_cskip;
+		++*probes;
+		if (!shash_get(shorta_hash, &addr)) {
+			*res = addr;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < tree_cm - tree_rm; i++) {
+		addr = range_min + tree_rm * tree_cskip + i;
+		++*probes;
+		if (!shash_get(shorta_hash, &addr)) {
+			*res = addr;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* probes: how many addresses were looked at */
+static int addrdb_flat_find(uint16_t *res, unsigned int *probes)
+{
+	unsigned int span = range_max - range_min + 1, i;
+	uint16_t addr = last_addr;
+
+	for (i = 0; i < span; i++) {
+		addr = (addr < range_min || addr >= range_max) ? range_min : addr + 1;
+		++*probes;
+		if (!shash_get(shorta_hash, &addr)) {
+			*res = addr;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void addrdb_free(struct lease *lease)
+{
+	shash_drop(hwa_hash, &lease->hwaddr);
+	shash_drop(shorta_hash, &lease->short_addr);
+	if (!lease->pending) {
+		lease_count--;
+		addrdb_notify(ADDRDB_LEASE_DEL, lease);
+	}
+	free(lease);
+}
+
+static uint16_t addrdb_do_alloc(uint8_t *hwa, int pending, int router)
 {
 	struct lease *lease = shash_get(hwa_hash, hwa);
-	if (lease) {
+	unsigned int probes = 0;
+
+	PROBE2(addrdb, alloc__entry, hwa, pending);
+	if (lease && addrdb_in_range(lease->short_addr)) {
 		lease->time = time(NULL);
+		if (lease->pending && !pending) {
+			lease->pending = 0;
+			lease_count++;
+			addrdb_notify(ADDRDB_LEASE_ADD, lease);
+		} else if (!lease->pending) {
+			addrdb_notify(ADDRDB_LEASE_REFRESH, lease);
+		}
+		PROBE2(addrdb, alloc__return, lease->short_addr, probes);
 		return lease->short_addr;
 	}
+	/* Quarantined by a range change, move it */
+	if (lease)
+		addrdb_free(lease);
 
-	int addr = last_addr + 1;
-	if (addr > range_max)
-			return 0xffff;
+	uint16_t addr;
 
-	while (shash_get(shorta_hash, &addr)) {
-		addr ++;
-		if (addr == last_addr || addr > range_max)
-			return 0xffff;
-		else if (addr == 0xfffe)
-			addr = range_min;
+	if (tree_cm ? addrdb_tree_find(router, &addr, &probes) :
+		      addrdb_flat_find(&addr, &probes)) {
+		PROBE2(addrdb, alloc__return, 0xffff, probes);
+		return 0xffff;
 	}
 
 	lease = calloc(1, sizeof(*lease));
 	memcpy(lease->hwaddr, hwa, IEEE802154_ADDR_LEN);
 	lease->short_addr = addr;
+	lease->pending = pending;
+	lease->block = addrdb_tree_block(addr);
 	lease->time = time(NULL);
 
 	last_addr = addr;
@@ -110,15 +263,56 @@ uint16_t addrdb_alloc(uint8_t *hwa)
 	shash_insert(hwa_hash, lease->hwaddr, lease);
 	shash_insert(shorta_hash, &lease->short_addr, lease);
 
+	if (!pending) {
+		lease_count++;
+		addrdb_notify(ADDRDB_LEASE_ADD, lease);
+	}
+
 	log_msg(0, "addr %d:..:%d\n", lease->hwaddr[0], lease->hwaddr[7]);
+	PROBE2(addrdb, alloc__return, addr, probes);
 	return addr;
 }
 
-static void addrdb_free(struct lease *lease)
+uint16_t addrdb_alloc(uint8_t *hwa)
 {
-	shash_drop(hwa_hash, &lease->hwaddr);
-	shash_drop(shorta_hash, &lease->short_addr);
-	free(lease);
+	return addrdb_do_alloc(hwa, 0, 0);
+}
+
+uint16_t addrdb_alloc_pending(uint8_t *hwa, int router)
+{
+	return addrdb_do_alloc(hwa, 1, router);
+}
+
+int addrdb_commit(const uint8_t *hwa)
+{
+	struct lease *lease = shash_get(hwa_hash, hwa);
+
+	if (!lease || !lease->pending)
+		return -1;
+
+	lease->pending = 0;
+	lease_count++;
+	addrdb_notify(ADDRDB_LEASE_ADD, lease);
+	return 0;
+}
+
+int addrdb_release(const uint8_t *hwa)
+{
+	struct lease *lease = shash_get(hwa_hash, hwa);
+
+	if (!lease || !lease->pending)
+		return -1;
+
+	addrdb_free(lease);
+	return 0;
+}
+
+uint16_t addrdb_lookup_hw(const uint8_t *hwa)
+{
+	struct lease *lease = shash_get(hwa_hash, hwa);
+
+	return lease && !lease->pending && addrdb_in_range(lease->short_addr) ?
+		lease->short_addr : 0xffff;
 }
 
 void addrdb_free_hw(uint8_t *hwa)
@@ -142,10 +336,41 @@ void addrdb_free_short(uint16_t short_addr)
 	addrdb_free(lease);
 }
 
+unsigned int addrdb_lease_count(void)
+{
+	return lease_count;
+}
+
+unsigned int addrdb_pool_size(void)
+{
+	return tree_cm ? tree_cm : range_max - range_min + 1;
+}
+
+static void addrdb_count_outside(const uint8_t *hwa, uint16_t short_addr,
+		time_t stamp, void *arg)
+{
+	if (!addrdb_in_range(short_addr))
+		(*(unsigned int *)arg)++;
+}
+
+unsigned int addrdb_set_range(uint16_t min, uint16_t max)
+{
+	unsigned int outside = 0;
+
+	range_min = min;
+	range_max = max < ADDRDB_SHORT_MAX ? max : ADDRDB_SHORT_MAX;
+	if (!addrdb_in_range(last_addr))
+		last_addr = range_min;
+
+	addrdb_for_each(addrdb_count_outside, &outside);
+
+	return outside;
+}
+
 void addrdb_init(/*uint8_t *hwa, uint16_t short_addr, */ uint16_t min, uint16_t max)
 {
 	last_addr = range_min = min;
-	range_max = max;
+	range_max = max < ADDRDB_SHORT_MAX ? max : ADDRDB_SHORT_MAX;
 
 	hwa_hash = shash_new(hw_hash, hw_eq);
 	if (!hwa_hash) {
@@ -162,52 +387,145 @@ void addrdb_init(/*uint8_t *hwa, uint16_t short_addr, */ uint16_t min, uint16_t
 
 #define MAX_CONFIG_BLOCK 128
 
-int addrdb_dump_leases(const char *lease_file)
+void addrdb_write_lease(FILE *f, const uint8_t *hwa, uint16_t short_addr, time_t stamp)
 {
-	int i;
-	struct lease *lease;
 	char hwaddr_buf[8 * 3];
-	FILE *f = fopen(lease_file, "w");
-	if (!f)
-		return -1;
-	for (i = 0; i < 65536; i++)
-	{
-		// FIXME: shash_for_each ?!
-		lease = shash_get(shorta_hash, &i);
-		if (!lease) {
+
+	snprintf(hwaddr_buf, sizeof(hwaddr_buf),
+			"%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n",
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7]);
+	fprintf(f,
+		"lease {\n\thwaddr %s;"
+		"\n\tshortaddr 0x%04x;\n\ttimestamp 0x%08lx;\n};\n",
+		hwaddr_buf, short_addr, stamp);
+}
+
+unsigned int addrdb_walk(unsigned int start, unsigned int budget,
+		addrdb_iter_t fn, void *arg)
+{
+	struct lease *lease;
+	unsigned int i;
+	uint16_t addr;
+
+	for (i = start; i < 65536 && budget; i++) {
+		addr = i;
+		lease = shash_get(shorta_hash, &addr);
+		if (!lease || lease->pending)
 			continue;
-		}
-		snprintf(hwaddr_buf, sizeof(hwaddr_buf),
-				"%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n",
-				lease->hwaddr[0], lease->hwaddr[1],
-				lease->hwaddr[2], lease->hwaddr[3],
-				lease->hwaddr[4], lease->hwaddr[5],
-				lease->hwaddr[6], lease->hwaddr[7]);
-		fprintf(f,
-			"lease {\n\thwaddr %s;"
-			"\n\tshortaddr 0x%04x;\n\ttimestamp 0x%08lx;\n};\n",
-			hwaddr_buf, lease->short_addr, lease->time);
+		fn(lease->hwaddr, lease->short_addr, lease->time, arg);
+		budget--;
 	}
+
+	return i;
+}
+
+void addrdb_for_each(addrdb_iter_t fn, void *arg)
+{
+	addrdb_walk(0, 65536, fn, arg);
+}
+
+int addrdb_get_hw(const uint8_t *hwa, uint16_t *short_addr, time_t *stamp)
+{
+	struct lease *lease = shash_get(hwa_hash, hwa);
+
+	if (!lease || lease->pending)
+		return -1;
+	*short_addr = lease->short_addr;
+	*stamp = lease->time;
+	return 0;
+}
+
+int addrdb_get_short(uint16_t short_addr, uint8_t *hwa, time_t *stamp)
+{
+	struct lease *lease = shash_get(shorta_hash, &short_addr);
+
+	if (!lease || lease->pending)
+		return -1;
+	memcpy(hwa, lease->hwaddr, IEEE802154_ADDR_LEN);
+	*stamp = lease->time;
+	return 0;
+}
+
+int addrdb_get_block(uint16_t short_addr, uint16_t *first, uint16_t *last)
+{
+	struct lease *lease = shash_get(shorta_hash, &short_addr);
+
+	if (!lease || lease->pending || lease->block <= 1)
+		return -1;
+	*first = short_addr;
+	*last = short_addr + lease->block - 1;
+	return 0;
+}
+
+int addrdb_block_owner(uint16_t short_addr, uint16_t *router)
+{
+	unsigned int off = short_addr - range_min;
+	uint16_t first, last;
+
+	if (!tree_cm || short_addr < range_min || off >= tree_rm * tree_cskip)
+		return -1;
+
+	first = short_addr - off % tree_cskip;
+	if (addrdb_get_block(first, &first, &last))
+		return -1;
+	*router = first;
+	return 0;
+}
+
+static void dump_lease(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	addrdb_write_lease(arg, hwa, short_addr, stamp);
+}
+
+int addrdb_dump_leases(const char *lease_file)
+{
+	FILE *f;
+
+	PROBE1(addrdb, dump__start, lease_file);
+	f = fopen(lease_file, "w");
+	if (!f)
+		return -1;
+	addrdb_for_each(dump_lease, f);
+	PROBE2(addrdb, dump__end, lease_file, ftell(f));
 	fclose(f);
 	return 0;
 }
 
-void addrdb_insert(uint8_t *hwaddr, uint16_t short_addr, time_t stamp)
+static void addrdb_do_insert(const uint8_t *hwaddr, uint16_t short_addr,
+		time_t stamp, int quiet)
 {
 	struct lease * lease = shash_get(hwa_hash, hwaddr);
 	if(lease) {
-		log_msg(0, "Got existing lease\n");
+		if (!quiet)
+			log_msg(0, "Got existing lease\n");
 		if (lease->short_addr != short_addr)
 			log_msg(0, "Mismatch of short addresses for the node!\n");
-		else if(stamp > lease->time) /* FIXME */
+		else if(stamp > lease->time) { /* FIXME */
 			lease->time = stamp;
+			addrdb_notify(ADDRDB_LEASE_REFRESH, lease);
+		}
 	} else {
-		log_msg(0, "Adding lease\n");
+		if (!quiet)
+			log_msg(0, "Adding lease\n");
 		lease = calloc(1, sizeof(*lease));
 		memcpy(lease->hwaddr, hwaddr, IEEE802154_ADDR_LEN);
 		lease->short_addr = short_addr;
+		lease->block = addrdb_tree_block(short_addr);
 		lease->time = stamp;
 		shash_insert(hwa_hash, lease->hwaddr, lease);
 		shash_insert(shorta_hash, &lease->short_addr, lease);
+		lease_count++;
+		addrdb_notify(ADDRDB_LEASE_ADD, lease);
 	}
 }
+
+void addrdb_insert(uint8_t *hwaddr, uint16_t short_addr, time_t stamp)
+{
+	addrdb_do_insert(hwaddr, short_addr, stamp, 0);
+}
+
+void addrdb_insert_quiet(const uint8_t *hwaddr, uint16_t short_addr, time_t stamp)
+{
+	addrdb_do_insert(hwaddr, short_addr, stamp, 1);
+}
@@ -22,16 +22,84 @@
 #ifndef ADDRDB_H
 #define ADDRDB_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 
+enum addrdb_event {
+	ADDRDB_LEASE_ADD,
+	ADDRDB_LEASE_REFRESH,
+	ADDRDB_LEASE_DEL,
+};
+
+/*
+ * Called after every change of the lease table. The coordinator uses
+ * this to feed lease mutations to its persistence thread.
+ */
+typedef void (*addrdb_notify_t)(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp);
+
+typedef void (*addrdb_iter_t)(const uint8_t *hwa, uint16_t short_addr,
+		time_t stamp, void *arg);
+
+/* Highest address handed out: 0xfffe and 0xffff mean "no short address" */
+#define ADDRDB_SHORT_MAX	0xfffd
+
+/* Both clamp max to ADDRDB_SHORT_MAX */
 void addrdb_init(/*uint8_t *hwa, uint16_t short_addr, */ uint16_t min, uint16_t max);
+/*
+ * Leases outside the new range are kept, so nobody else gets those
+ * addresses, but their owners are moved into the range when they
+ * associate again. Returns how many leases are outside.
+ */
+unsigned int addrdb_set_range(uint16_t min, uint16_t max);
+/*
+ * Tree mode: cm children at most, rm of them routers, lm levels deep.
+ * Routers get a whole block of addresses to hand out to their own
+ * children, sized as in Cskip, the rest of the range is unused. cm 0
+ * allocates from the whole range again. Set it before any lease is
+ * loaded; fails if the tree does not fit into the range.
+ */
+int addrdb_set_tree(unsigned int cm, unsigned int rm, unsigned int lm);
 uint16_t addrdb_alloc(uint8_t *hwa);
+/*
+ * Like addrdb_alloc(), but a new lease stays invisible to notify, walks
+ * and lookups until it is committed. Releasing gives the address back
+ * as if it had never been handed out. Both return -1 unless hwa has a
+ * pending lease. In tree mode a router gets a block if one is free.
+ */
+uint16_t addrdb_alloc_pending(uint8_t *hwa, int router);
+int addrdb_commit(const uint8_t *hwa);
+int addrdb_release(const uint8_t *hwa);
+/* Short address leased to hwa, 0xffff if there is none */
+uint16_t addrdb_lookup_hw(const uint8_t *hwa);
 void addrdb_free_hw(uint8_t *hwa);
 void addrdb_free_short(uint16_t shirt_addr);
 
 int addrdb_parse(const char *fname);
 int addrdb_dump_leases(const char *lease_file);
 void addrdb_insert(uint8_t *hwa, uint16_t short_addr, time_t stamp);
+/* Same without logging each lease, for whole tables taken over at once */
+void addrdb_insert_quiet(const uint8_t *hwa, uint16_t short_addr, time_t stamp);
+void addrdb_set_notify(addrdb_notify_t fn);
+void addrdb_for_each(addrdb_iter_t fn, void *arg);
+/*
+ * Calls fn for at most budget leases, in short address order from
+ * start on. Returns where to go on from, 0x10000 past the last one.
+ */
+unsigned int addrdb_walk(unsigned int start, unsigned int budget,
+		addrdb_iter_t fn, void *arg);
+/* Both return 0 if there is such a lease, -1 otherwise */
+int addrdb_get_hw(const uint8_t *hwa, uint16_t *short_addr, time_t *stamp);
+int addrdb_get_short(uint16_t short_addr, uint8_t *hwa, time_t *stamp);
+/* Block delegated to the router at short_addr; -1 if it has none */
+int addrdb_get_block(uint16_t short_addr, uint16_t *first, uint16_t *last);
+/* Router whose block holds short_addr; -1 if the block is not leased */
+int addrdb_block_owner(uint16_t short_addr, uint16_t *router);
+/* Leases a walk would see: pending ones are not counted */
+unsigned int addrdb_lease_count(void);
+unsigned int addrdb_pool_size(void);
+void addrdb_write_lease(FILE *f, const uint8_t *hwa, uint16_t short_addr, time_t stamp);
 
 
 #endif
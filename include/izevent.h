@@ -0,0 +1,116 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Events of the IEEE 802.15.4 multicast group as published by izeventd:
+ * one decoded record per netlink message in a shared memory ring that
+ * any number of local readers map read-only.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef IZEVENT_H
+#define IZEVENT_H
+
+#include <stdint.h>
+
+#define IZEVENT_MAGIC		"IZEVENT1"
+#define IZEVENT_NAME_LEN	16
+
+/* Bit of present for an attribute the message carried */
+#define IZEVENT_HAS(ev, attr)	((ev)->present & (1ULL << (attr)))
+
+/*
+ * Every scalar attribute of the family has its own field, so a record
+ * has one size whatever the command. Lists (ED_LIST, CHANNEL_PAGE_LIST)
+ * are not carried. Like in the izcoordinator trace, seq is written
+ * last and a reader only trusts a record whose seq is the one it expects.
+ */
+struct izevent {
+	uint32_t seq;		/* low 32 bits of (index + 1) */
+	uint32_t dev_index;
+	uint64_t ts;		/* CLOCK_MONOTONIC when izeventd read it, ns */
+	uint64_t present;	/* 1 << IEEE802154_ATTR_* */
+
+	uint64_t hw_addr;
+	uint64_t coord_hw_addr;
+	uint64_t src_hw_addr;
+	uint64_t dest_hw_addr;
+	uint32_t channels;
+
+	uint16_t short_addr;
+	uint16_t pan_id;
+	uint16_t coord_short_addr;
+	uint16_t coord_pan_id;
+	uint16_t src_short_addr;
+	uint16_t src_pan_id;
+	uint16_t dest_short_addr;
+	uint16_t dest_pan_id;
+
+	uint8_t cmd;		/* IEEE802154_* genl command */
+	uint8_t status;
+	uint8_t channel;
+	uint8_t page;
+	uint8_t capability;
+	uint8_t reason;
+	uint8_t scan_type;
+	uint8_t duration;
+	uint8_t bcn_ord;
+	uint8_t sf_ord;
+	uint8_t pan_coord;
+	uint8_t bat_ext;
+	uint8_t coord_realign;
+	uint8_t sec;
+	uint8_t dev_type;
+	uint8_t pad;
+
+	char dev_name[IZEVENT_NAME_LEN];
+	char phy_name[IZEVENT_NAME_LEN];
+	uint32_t reserved;
+};
+
+struct izevent_ring {
+	char magic[8];
+	uint32_t nrec;		/* power of two */
+	uint32_t rec_size;
+	/* Times the kernel dropped messages because izeventd was too slow */
+	uint64_t nl_lost;
+	uint64_t head __attribute__((aligned(64)));
+	struct izevent rec[] __attribute__((aligned(64)));
+};
+
+/*
+ * Reader side, in libcommon. A reader sees the events published after
+ * izevent_open(); poll izevent_fd() for POLLIN to wait for more.
+ *
+ * izevent_peek() hands out the next record in place. It may be
+ * overwritten while the caller looks at it if the caller falls a whole
+ * ring behind, so izevent_done() tells whether what was read still holds.
+ */
+struct izevent_reader;
+
+int izevent_open(const char *path, struct izevent_reader **res);
+void izevent_close(struct izevent_reader *r);
+int izevent_fd(const struct izevent_reader *r);
+/* Call when woken, before reading on: resets izevent_fd() */
+void izevent_ack(struct izevent_reader *r);
+const struct izevent *izevent_peek(struct izevent_reader *r);
+/* 0, or -ESTALE if the record was overwritten meanwhile */
+int izevent_done(struct izevent_reader *r, const struct izevent *ev);
+/* Copying variant of the two above: 1 with a record, 0 without */
+int izevent_next(struct izevent_reader *r, struct izevent *ev);
+/* Records this reader missed by falling behind */
+uint64_t izevent_lost(const struct izevent_reader *r);
+uint64_t izevent_nl_lost(const struct izevent_reader *r);
+
+#endif
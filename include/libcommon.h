@@ -25,9 +25,15 @@
 void printbuf(const unsigned char *buf, int len);
 
 int parse_hw_addr(const char *addr, unsigned char *buf);
+/* "xx:..:xx" only; returns the characters taken, or -1 */
+int parse_hwaddr(const char *s, unsigned char *hwa);
 
 struct nl_sock;
+/* Both answered from one cached GETFAMILY reply per socket and family */
+int nl_get_family_id(struct nl_sock *handle, const char *family);
 int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *group);
+/* Call before freeing the socket */
+void nl_forget_families(struct nl_sock *handle);
 
 struct simple_hash;
 typedef unsigned int (*shash_hash)(const void *key);
@@ -35,6 +41,22 @@ typedef int (*shash_eq)(const void *key1, const void *key2);
 struct simple_hash *shash_new(shash_hash hashfn, shash_eq eqfn);
 void *shash_insert(struct simple_hash *hash, const void *key, void *ptr);
 void *shash_get(struct simple_hash *hash, const void *key);
+/* Returns the data that was stored under key */
 void *shash_drop(struct simple_hash *hash, const void *key);
+typedef void (*shash_iter)(const void *key, void *data, void *arg);
+/* In no particular order; fn may drop the element it is given */
+void shash_for_each(struct simple_hash *hash, shash_iter fn, void *arg);
+unsigned int shash_count(struct simple_hash *hash);
+/* For tables keyed by an extended (EUI-64) address */
+unsigned int hw_hash(const void *key);
+int hw_eq(const void *key1, const void *key2);
+
+/* Lock-free ring for exactly one producer and one consumer thread */
+struct spsc_ring;
+struct spsc_ring *spsc_ring_new(unsigned int size, unsigned int elem_size);
+void spsc_ring_free(struct spsc_ring *ring);
+int spsc_ring_push(struct spsc_ring *ring, const void *elem);
+int spsc_ring_pop(struct spsc_ring *ring, void *elem);
+int spsc_ring_empty(struct spsc_ring *ring);
 
 #endif
@@ -22,7 +22,25 @@
 
 #ifndef LOGGING_H
 #define LOGGING_H
+
+enum {
+	LOG_TARGET_SYSLOG,
+	LOG_TARGET_STDERR,
+	LOG_TARGET_FILE,
+};
+
 void init_log(char * name, int level);
-void log_msg(int level, char * format, ...);
+void log_set_level(int level);
+void log_msg(int level, char * format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/*
+ * Hand formatted messages to a background writer thread instead of
+ * calling syslog() from the caller. Messages that do not fit into the
+ * queue are dropped and counted.
+ */
+int log_start_async(int target, const char *path);
+void log_stop_async(void);
+unsigned long log_dropped(void);
 #endif
 
@@ -0,0 +1,46 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Static tracepoints for perf, bpftrace or SystemTap, e.g.
+ *   bpftrace -e 'usdt:/usr/sbin/izcoordinator:izcoordinator:assoc__resp { ... }'
+ * Each one is a single nop unless a tracer is attached; without
+ * <sys/sdt.h> they compile to nothing and arguments are not evaluated.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE(provider, name)			DTRACE_PROBE(provider, name)
+#define PROBE1(provider, name, a)		DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b)		DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c)		DTRACE_PROBE3(provider, name, a, b, c)
+#define PROBE4(provider, name, a, b, c, d)	DTRACE_PROBE4(provider, name, a, b, c, d)
+#else
+/* sizeof keeps variables only a probe uses from being reported unused */
+#define PROBE(provider, name)			do { } while (0)
+#define PROBE1(provider, name, a)		do { (void)sizeof(a); } while (0)
+#define PROBE2(provider, name, a, b)		\
+	do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(provider, name, a, b, c)		\
+	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define PROBE4(provider, name, a, b, c, d)	\
+	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#endif
+
+#endif
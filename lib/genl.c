@@ -33,8 +33,29 @@
 #include <netlink/genl/ctrl.h>  
 #include <netlink/msg.h>
 #include <netlink/attr.h>
+#include <linux/genetlink.h>
+#include <string.h>
 
-//#include "iw.h"
+/*
+ * Family ids and group ids only change when the family is registered
+ * again, so one GETFAMILY answer is kept per socket and family.
+ */
+#define FAMILY_CACHE_SIZE	4
+#define FAMILY_MAX_GROUPS	8
+
+struct family_info {
+	struct nl_sock *handle;
+	char name[GENL_NAMSIZ];
+	int id;
+	int ngroups;
+	struct {
+		char name[GENL_NAMSIZ];
+		int id;
+	} groups[FAMILY_MAX_GROUPS];
+};
+
+static struct family_info family_cache[FAMILY_CACHE_SIZE];
+static unsigned int family_cache_next;
 
 static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
 			 void *arg)
@@ -51,14 +72,9 @@ static int ack_handler(struct nl_msg *msg, void *arg)
 	return NL_STOP;
 }
 
-struct handler_args {
-	const char *group;
-	int id;
-};
-
 static int family_handler(struct nl_msg *msg, void *arg)
 {
-	struct handler_args *grp = arg;
+	struct family_info *info = arg;
 	struct nlattr *tb[CTRL_ATTR_MAX + 1];
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
 	struct nlattr *mcgrp;
@@ -67,37 +83,44 @@ static int family_handler(struct nl_msg *msg, void *arg)
 	nla_parse(tb, CTRL_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
+	if (tb[CTRL_ATTR_FAMILY_ID])
+		info->id = nla_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+
         if (!tb[CTRL_ATTR_MCAST_GROUPS])
 		return NL_SKIP;
 
 	nla_for_each_nested(mcgrp, tb[CTRL_ATTR_MCAST_GROUPS], rem_mcgrp) {
 		struct nlattr *tb_mcgrp[CTRL_ATTR_MCAST_GRP_MAX + 1];
 
+		if (info->ngroups == FAMILY_MAX_GROUPS)
+			break;
+
 		nla_parse(tb_mcgrp, CTRL_ATTR_MCAST_GRP_MAX,
 			  nla_data(mcgrp), nla_len(mcgrp), NULL);
 
 		if (!tb_mcgrp[CTRL_ATTR_MCAST_GRP_NAME] ||
 		    !tb_mcgrp[CTRL_ATTR_MCAST_GRP_ID])
 			continue;
-		if (strncmp(nla_data(tb_mcgrp[CTRL_ATTR_MCAST_GRP_NAME]),
-			    grp->group, nla_len(tb_mcgrp[CTRL_ATTR_MCAST_GRP_NAME])))
-			continue;
-		grp->id = nla_get_u32(tb_mcgrp[CTRL_ATTR_MCAST_GRP_ID]);
-		break;
+
+		nla_strlcpy(info->groups[info->ngroups].name,
+			    tb_mcgrp[CTRL_ATTR_MCAST_GRP_NAME], GENL_NAMSIZ);
+		info->groups[info->ngroups].id =
+			nla_get_u32(tb_mcgrp[CTRL_ATTR_MCAST_GRP_ID]);
+		info->ngroups++;
 	}
 	
 	return NL_SKIP;
 }
 
-int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *group)
+/*
+ * Asks the controller directly (it always has GENL_ID_CTRL) for the
+ * family, which answers with its id and all of its groups at once.
+ */
+static int family_query(struct nl_sock *handle, struct family_info *info)
 {
 	struct nl_msg *msg;
 	struct nl_cb *cb;
-	int ret, ctrlid;
-	struct handler_args grp = {
-		.group = group,
-		.id = -ENOENT,
-	};
+	int ret;
 
 	msg = nlmsg_alloc();
 	if (!msg)
@@ -109,13 +132,11 @@ int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *
 		goto out_fail_cb;
 	}
 
-	ctrlid = genl_ctrl_resolve(handle, "nlctrl");
-
-        genlmsg_put(msg, 0, 0, ctrlid, 0,
+        genlmsg_put(msg, 0, 0, GENL_ID_CTRL, 0,
 		    0, CTRL_CMD_GETFAMILY, 0);
 
 	ret = -ENOBUFS;
-	NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, family);
+	NLA_PUT_STRING(msg, CTRL_ATTR_FAMILY_NAME, info->name);
 
 	ret = nl_send_auto_complete(handle, msg);
 	if (ret < 0)
@@ -125,13 +146,13 @@ int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *
 
 	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &ret);
 	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &ret);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, family_handler, &grp);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, family_handler, info);
 
 	while (ret > 0)
 		nl_recvmsgs(handle, cb);
 
-	if (ret == 0)
-		ret = grp.id;
+	if (ret == 0 && info->id < 0)
+		ret = -ENOENT;
  nla_put_failure:
  out:
 	nl_cb_put(cb);
@@ -139,3 +160,66 @@ int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *
 	nlmsg_free(msg);
 	return ret;
 }
+
+static struct family_info *family_get(struct nl_sock *handle, const char *family, int *err)
+{
+	struct family_info *info;
+	int i;
+
+	for (i = 0; i < FAMILY_CACHE_SIZE; i++) {
+		info = &family_cache[i];
+		if (info->handle == handle && !strncmp(info->name, family, GENL_NAMSIZ))
+			return info;
+	}
+
+	info = &family_cache[family_cache_next++ % FAMILY_CACHE_SIZE];
+	memset(info, 0, sizeof(*info));
+	strncpy(info->name, family, GENL_NAMSIZ - 1);
+	info->id = -1;
+
+	*err = family_query(handle, info);
+	if (*err < 0) {
+		memset(info, 0, sizeof(*info));
+		return NULL;
+	}
+
+	info->handle = handle;
+	return info;
+}
+
+int nl_get_family_id(struct nl_sock *handle, const char *family)
+{
+	struct family_info *info;
+	int err;
+
+	info = family_get(handle, family, &err);
+	if (!info)
+		return err;
+
+	return info->id;
+}
+
+int nl_get_multicast_id(struct nl_sock *handle, const char *family, const char *group)
+{
+	struct family_info *info;
+	int i, err;
+
+	info = family_get(handle, family, &err);
+	if (!info)
+		return err;
+
+	for (i = 0; i < info->ngroups; i++)
+		if (!strncmp(info->groups[i].name, group, GENL_NAMSIZ))
+			return info->groups[i].id;
+
+	return -ENOENT;
+}
+
+void nl_forget_families(struct nl_sock *handle)
+{
+	int i;
+
+	for (i = 0; i < FAMILY_CACHE_SIZE; i++)
+		if (family_cache[i].handle == handle)
+			memset(&family_cache[i], 0, sizeof(family_cache[i]));
+}
@@ -0,0 +1,249 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Reader side of the izeventd event ring.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <izevent.h>
+
+struct izevent_reader {
+	const struct izevent_ring *ring;
+	size_t map_size;
+	uint64_t pos;		/* index of the next record we read */
+	uint64_t lost;
+	int sock;		/* izeventd forgets us when it is closed */
+	int efd;
+};
+
+/* izeventd sends the ring and our eventfd right after accepting us */
+static int izevent_recv_fds(int sock, int *ring_fd, int *efd)
+{
+	union {
+		struct cmsghdr cm;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} u;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	ssize_t n;
+	char c;
+	int fds[2];
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (n < 0)
+		return -errno;
+	if (!n)
+		return -ECONNRESET;
+
+	cm = CMSG_FIRSTHDR(&msg);
+	if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+	    cm->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+		return -EPROTO;
+
+	memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+	*ring_fd = fds[0];
+	*efd = fds[1];
+
+	return 0;
+}
+
+int izevent_open(const char *path, struct izevent_reader **res)
+{
+	struct izevent_reader *r;
+	struct sockaddr_un sun;
+	const struct izevent_ring *ring;
+	int ring_fd = -1, err;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(sun.sun_path))
+		return -ENAMETOOLONG;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	r->efd = -1;
+
+	r->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (r->sock < 0) {
+		err = -errno;
+		goto out_free;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	if (connect(r->sock, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		err = -errno;
+		goto out_close;
+	}
+
+	err = izevent_recv_fds(r->sock, &ring_fd, &r->efd);
+	if (err < 0)
+		goto out_close;
+
+	if (fstat(ring_fd, &st)) {
+		err = -errno;
+		goto out_close;
+	}
+	if (st.st_size < (off_t)sizeof(*ring)) {
+		err = -EPROTO;
+		goto out_close;
+	}
+
+	ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, ring_fd, 0);
+	if (ring == MAP_FAILED) {
+		err = -errno;
+		goto out_close;
+	}
+	close(ring_fd);
+	ring_fd = -1;
+
+	if (memcmp(ring->magic, IZEVENT_MAGIC, sizeof(ring->magic)) ||
+	    ring->rec_size != sizeof(struct izevent) ||
+	    !ring->nrec || (ring->nrec & (ring->nrec - 1)) ||
+	    st.st_size < (off_t)(sizeof(*ring) + (uint64_t)ring->nrec * ring->rec_size)) {
+		munmap((void *)ring, st.st_size);
+		err = -EPROTO;
+		goto out_close;
+	}
+
+	r->ring = ring;
+	r->map_size = st.st_size;
+	r->pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	*res = r;
+
+	return 0;
+
+out_close:
+	if (ring_fd >= 0)
+		close(ring_fd);
+	if (r->efd >= 0)
+		close(r->efd);
+	close(r->sock);
+out_free:
+	free(r);
+	return err;
+}
+
+void izevent_close(struct izevent_reader *r)
+{
+	if (!r)
+		return;
+
+	munmap((void *)r->ring, r->map_size);
+	close(r->efd);
+	close(r->sock);
+	free(r);
+}
+
+int izevent_fd(const struct izevent_reader *r)
+{
+	return r->efd;
+}
+
+void izevent_ack(struct izevent_reader *r)
+{
+	uint64_t cnt;
+
+	if (read(r->efd, &cnt, sizeof(cnt)) < 0)
+		return;
+}
+
+const struct izevent *izevent_peek(struct izevent_reader *r)
+{
+	const struct izevent_ring *ring = r->ring;
+	const struct izevent *ev;
+	uint64_t head;
+
+	for (;;) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (r->pos == head)
+			return NULL;
+
+		/* A whole ring behind: what we wanted is gone */
+		if (head - r->pos > ring->nrec) {
+			r->lost += head - ring->nrec - r->pos;
+			r->pos = head - ring->nrec;
+		}
+
+		/* The oldest slot may be the one izeventd is writing right now */
+		ev = &ring->rec[r->pos & (ring->nrec - 1)];
+		if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) == (uint32_t)(r->pos + 1))
+			return ev;
+
+		r->lost++;
+		r->pos++;
+	}
+}
+
+int izevent_done(struct izevent_reader *r, const struct izevent *ev)
+{
+	uint32_t seq = r->pos + 1;
+
+	r->pos++;
+
+	/* Everything read from ev so far is ordered before this check */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&ev->seq, __ATOMIC_RELAXED) != seq) {
+		r->lost++;
+		return -ESTALE;
+	}
+
+	return 0;
+}
+
+int izevent_next(struct izevent_reader *r, struct izevent *ev)
+{
+	const struct izevent *p;
+
+	while ((p = izevent_peek(r))) {
+		memcpy(ev, p, sizeof(*ev));
+		if (!izevent_done(r, p))
+			return 1;
+	}
+
+	return 0;
+}
+
+uint64_t izevent_lost(const struct izevent_reader *r)
+{
+	return r->lost;
+}
+
+uint64_t izevent_nl_lost(const struct izevent_reader *r)
+{
+	return __atomic_load_n(&r->ring->nl_lost, __ATOMIC_RELAXED);
+}
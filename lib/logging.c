@@ -31,53 +31,334 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include <logging.h>
+
+/* Longer messages are truncated */
+#define LOG_REC_MAX	240
+/* Must be a power of two */
+#define LOG_RING_SIZE	1024
+/* Records handed to the output in one go */
+#define LOG_BATCH	64
+
+struct log_rec {
+	time_t stamp;
+	unsigned short len;
+	char text[LOG_REC_MAX];
+};
+
+/*
+ * Bounded multi-producer queue (D. Vyukov): each cell carries a
+ * sequence number telling whether it may be written or read in the
+ * current lap, so producers only contend on the enqueue index.
+ */
+struct log_cell {
+	unsigned int seq;
+	struct log_rec rec;
+};
 
 static int log_level = 0;
+static const char *log_name;
+
+static struct log_cell *ring;
+static unsigned int enqueue_pos __attribute__((aligned(64)));
+static unsigned int dequeue_pos __attribute__((aligned(64)));
+static unsigned long dropped;
 
-static void log_string(int level, char *s)
+static int log_target = LOG_TARGET_SYSLOG;
+static int log_fd = -1;
+static int wake_fd[2] = { -1, -1 };
+static int sleeping;
+static int stop_requested;
+static pthread_t writer;
+
+void init_log(char * name, int level)
 {
+	log_name = name;
+	log_level = level;
 #ifdef HAVE_SYSLOG_H
-	if (level <= log_level)
-		syslog(LOG_INFO, "%s", s);
+	openlog(name, LOG_PID|LOG_CONS|LOG_NOWAIT, LOG_DAEMON);
 #endif
 }
 
-void init_log(char * name, int level)
+void log_set_level(int level)
+{
+	__atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+unsigned long log_dropped(void)
 {
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+static int log_enqueue(const char *text, int len)
+{
+	unsigned int pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+	struct log_cell *cell;
+
+	while (1) {
+		int diff;
+
+		cell = &ring[pos & (LOG_RING_SIZE - 1)];
+		diff = (int)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -EAGAIN;
+		} else {
+			pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->rec.stamp = time(NULL);
+	cell->rec.len = len;
+	memcpy(cell->rec.text, text, len);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Only ever called from the writer thread */
+static int log_dequeue(struct log_rec *rec)
+{
+	struct log_cell *cell = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1)
+		return 0;
+
+	memcpy(rec, &cell->rec, offsetof(struct log_rec, text) + cell->rec.len);
+	__atomic_store_n(&cell->seq, dequeue_pos + LOG_RING_SIZE, __ATOMIC_RELEASE);
+	dequeue_pos++;
+
+	return 1;
+}
+
+static void log_wake(void)
+{
+	char c = 0;
+
+	if (write(wake_fd[1], &c, 1) < 0)
+		; /* pipe full: a wakeup is pending anyway */
+}
+
+static void log_output(struct log_rec *recs, int n)
+{
+	static char prefix[LOG_BATCH][64];
+	struct iovec iov[LOG_BATCH * 3];
+	int i, k = 0;
+
+	if (log_target == LOG_TARGET_SYSLOG) {
 #ifdef HAVE_SYSLOG_H
-	log_level = level;
-	openlog(name, LOG_PID|LOG_CONS|LOG_NOWAIT, LOG_DAEMON);
+		for (i = 0; i < n; i++)
+			syslog(LOG_INFO, "%.*s", recs[i].len, recs[i].text);
 #endif
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct tm tm;
+		int len;
+
+		localtime_r(&recs[i].stamp, &tm);
+		len = strftime(prefix[i], sizeof(prefix[i]), "%b %e %H:%M:%S ", &tm);
+		len += snprintf(prefix[i] + len, sizeof(prefix[i]) - len, "%s[%d]: ",
+				log_name ? log_name : "", (int)getpid());
+		iov[k].iov_base = prefix[i];
+		iov[k++].iov_len = len;
+		iov[k].iov_base = recs[i].text;
+		iov[k++].iov_len = recs[i].len;
+		if (!recs[i].len || recs[i].text[recs[i].len - 1] != '\n') {
+			iov[k].iov_base = "\n";
+			iov[k++].iov_len = 1;
+		}
+	}
+
+	if (writev(log_fd, iov, k) < 0)
+		; /* nowhere left to complain */
 }
 
-void log_msg(int level, char * format, ...)
+static void *log_writer(void *arg)
 {
+	static struct log_rec batch[LOG_BATCH];
+	struct pollfd pfd = { .fd = wake_fd[0], .events = POLLIN };
+	unsigned long reported = 0;
+	char buf[64];
 	int n;
-	int size = 100;
+
+	while (1) {
+		/* Read before draining, so nothing queued before a stop is lost */
+		int stop = __atomic_load_n(&stop_requested, __ATOMIC_ACQUIRE);
+		unsigned long lost;
+
+		do {
+			n = 0;
+			while (n < LOG_BATCH && log_dequeue(&batch[n]))
+				n++;
+			if (n)
+				log_output(batch, n);
+		} while (n == LOG_BATCH);
+
+		lost = log_dropped();
+		if (lost != reported) {
+			batch[0].stamp = time(NULL);
+			batch[0].len = snprintf(batch[0].text, LOG_REC_MAX,
+					"log: %lu messages dropped\n", lost - reported);
+			log_output(batch, 1);
+			reported = lost;
+		}
+
+		if (stop)
+			break;
+
+		__atomic_store_n(&sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring[dequeue_pos & (LOG_RING_SIZE - 1)].seq,
+				__ATOMIC_ACQUIRE) != dequeue_pos + 1)
+			poll(&pfd, 1, -1);
+		__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+
+		while (read(wake_fd[0], buf, sizeof(buf)) > 0)
+			;
+	}
+
+	return NULL;
+}
+
+int log_start_async(int target, const char *path)
+{
+	struct log_cell *r;
+	sigset_t all, old;
+	unsigned int i;
+	int fd = -1, err;
+
+	if (ring)
+		return -EBUSY;
+
+	if (target == LOG_TARGET_FILE) {
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+		if (fd < 0)
+			return -errno;
+	} else if (target == LOG_TARGET_STDERR) {
+		fd = 2;
+	}
+
+	r = calloc(LOG_RING_SIZE, sizeof(*r));
+	if (!r) {
+		err = -ENOMEM;
+		goto out_fd;
+	}
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		r[i].seq = i;
+
+	if (pipe(wake_fd)) {
+		err = -errno;
+		goto out_ring;
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(wake_fd[i], F_SETFL, fcntl(wake_fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(wake_fd[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* Messages go to the ring from here on, so the writer must start */
+	log_fd = fd;
+	log_target = target;
+	enqueue_pos = dequeue_pos = 0;
+	ring = r;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&writer, NULL, log_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		err = -err;
+		ring = NULL;
+		log_target = LOG_TARGET_SYSLOG;
+		log_fd = -1;
+		goto out_pipe;
+	}
+
+	return 0;
+
+out_pipe:
+	close(wake_fd[0]);
+	close(wake_fd[1]);
+	wake_fd[0] = wake_fd[1] = -1;
+out_ring:
+	free(r);
+out_fd:
+	if (target == LOG_TARGET_FILE)
+		close(fd);
+	return err;
+}
+
+/*
+ * Writes out everything queued so far and goes back to synchronous
+ * logging. Other threads must not log any more at this point.
+ */
+void log_stop_async(void)
+{
+	struct log_cell *r = ring;
+
+	if (!r)
+		return;
+
+	__atomic_store_n(&stop_requested, 1, __ATOMIC_RELEASE);
+	log_wake();
+	pthread_join(writer, NULL);
+
+	ring = NULL;
+	free(r);
+	if (log_target == LOG_TARGET_FILE)
+		close(log_fd);
+	close(wake_fd[0]);
+	close(wake_fd[1]);
+	wake_fd[0] = wake_fd[1] = -1;
+	stop_requested = 0;
+	log_target = LOG_TARGET_SYSLOG;
+}
+
+void log_msg(int level, char * format, ...)
+{
+	char buf[LOG_REC_MAX];
 	va_list ap;
-	char *p, *np;
-	p = malloc(size);
-	if (!p)
+	int n;
+
+	if (level > __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+		return;
+
+	va_start(ap, format);
+	n = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n >= (int)sizeof(buf))
+		n = sizeof(buf) - 1;
+
+	if (!ring) {
+#ifdef HAVE_SYSLOG_H
+		syslog(LOG_INFO, "%s", buf);
+#endif
+		return;
+	}
+
+	if (log_enqueue(buf, n) < 0) {
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
 		return;
-	while(1) {
-		va_start(ap, format);
-		n = vsnprintf(p, size, format, ap);
-		va_end(ap);                                               
-		if (n > -1 && n < size) {
-			log_string(level, p);
-			free(p);
-			return;
-		}
-		/* Else try again with more space. */
-		if (n > -1)    /* glibc 2.1 */
-			size = n+1; /* precisely what is needed */
-		else           /* glibc 2.0 */
-			size *= 2;  /* twice the old size */
-		if ((np = realloc (p, size)) == NULL) {
-	    		free(p);
-			return;
-		} else {
-			p = np;
-		}
 	}
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleeping, __ATOMIC_RELAXED))
+		log_wake();
 }
@@ -24,6 +24,7 @@
 #endif
 
 #include <libcommon.h>
+#include <ieee802154.h>
 #include <errno.h>
 #include <stdio.h>
 
@@ -59,3 +60,22 @@ int parse_hw_addr(const char *hw, unsigned char *buf) {
 	return -EINVAL;
 }
 
+/*
+ * Strictly "xx:xx:xx:xx:xx:xx:xx:xx", as in the lease file. Returns how
+ * many characters it took, so the caller can check what follows.
+ */
+int parse_hwaddr(const char *s, unsigned char *hwa)
+{
+	unsigned int b[IEEE802154_ADDR_LEN];
+	int i, n;
+
+	if (sscanf(s, "%2x:%2x:%2x:%2x:%2x:%2x:%2x:%2x%n",
+			&b[0], &b[1], &b[2], &b[3],
+			&b[4], &b[5], &b[6], &b[7], &n) != IEEE802154_ADDR_LEN)
+		return -1;
+
+	for (i = 0; i < IEEE802154_ADDR_LEN; i++)
+		hwa[i] = b[i];
+
+	return n;
+}
@@ -0,0 +1,113 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Single-producer/single-consumer lock-free ring buffer.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libcommon.h>
+
+#define RING_CACHELINE 64
+
+/*
+ * head is only written by the producer, tail only by the consumer.
+ * They live on separate cache lines so that the two threads do not
+ * bounce a shared line on every operation.
+ */
+struct spsc_ring {
+	unsigned int mask;
+	unsigned int elem_size;
+	unsigned char *data;
+
+	unsigned int head __attribute__((aligned(RING_CACHELINE)));
+	unsigned int tail __attribute__((aligned(RING_CACHELINE)));
+};
+
+struct spsc_ring *spsc_ring_new(unsigned int size, unsigned int elem_size)
+{
+	struct spsc_ring *ring;
+	unsigned int n = 1;
+
+	if (!size || !elem_size)
+		return NULL;
+
+	while (n < size)
+		n <<= 1;
+
+	if (posix_memalign((void **)&ring, RING_CACHELINE, sizeof(*ring)))
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+
+	ring->data = calloc(n, elem_size);
+	if (!ring->data) {
+		free(ring);
+		return NULL;
+	}
+	ring->mask = n - 1;
+	ring->elem_size = elem_size;
+
+	return ring;
+}
+
+void spsc_ring_free(struct spsc_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->data);
+	free(ring);
+}
+
+int spsc_ring_push(struct spsc_ring *ring, const void *elem)
+{
+	unsigned int head = ring->head;
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail > ring->mask)
+		return -EAGAIN;
+
+	memcpy(ring->data + (head & ring->mask) * ring->elem_size,
+			elem, ring->elem_size);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int spsc_ring_pop(struct spsc_ring *ring, void *elem)
+{
+	unsigned int tail = ring->tail;
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return -EAGAIN;
+
+	memcpy(elem, ring->data + (tail & ring->mask) * ring->elem_size,
+			ring->elem_size);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int spsc_ring_empty(struct spsc_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+		__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
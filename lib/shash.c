@@ -25,37 +25,83 @@
 
 #include <libcommon.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ieee802154.h>
+
+/* Bucket count: starts here, doubles whenever it is exceeded by elements */
+#define SHASH_MIN_BUCKETS	64
 
 struct shash_elem {
 	const void *key;
 	void *data;
 	struct shash_elem *next;
-	struct shash_elem **prev;
 };
 
 struct simple_hash {
 	shash_hash hashfn;
 	shash_eq eqfn;
-	/* FIXME: it's a fake hash currently */
-	struct shash_elem *elem;
+	struct shash_elem **buckets;
+	unsigned int mask;
+	unsigned int count;
 };
 
+/* The callers' hash functions are cheap; spread their bits over the mask */
+static struct shash_elem **shash_bucket(struct simple_hash *hash, const void *key)
+{
+	unsigned int h = hash->hashfn(key) * 2654435761u;
+
+	return &hash->buckets[(h ^ (h >> 16)) & hash->mask];
+}
+
 struct simple_hash *shash_new(shash_hash hashfn, shash_eq eqfn)
 {
 	struct simple_hash *hash = calloc(1, sizeof(struct simple_hash));
-	if (hash) {
-		hash->hashfn = hashfn;
-		hash->eqfn = eqfn;
+	if (!hash)
+		return NULL;
+
+	hash->buckets = calloc(SHASH_MIN_BUCKETS, sizeof(*hash->buckets));
+	if (!hash->buckets) {
+		free(hash);
+		return NULL;
 	}
+	hash->hashfn = hashfn;
+	hash->eqfn = eqfn;
+	hash->mask = SHASH_MIN_BUCKETS - 1;
 
 	return hash;
 }
+
+static void shash_grow(struct simple_hash *hash)
+{
+	struct shash_elem **old = hash->buckets, *elem, *next;
+	unsigned int i, size = hash->mask + 1;
+
+	hash->buckets = calloc(size * 2, sizeof(*hash->buckets));
+	if (!hash->buckets) {
+		/* Keep going with longer chains */
+		hash->buckets = old;
+		return;
+	}
+	hash->mask = size * 2 - 1;
+
+	for (i = 0; i < size; i++)
+		for (elem = old[i]; elem; elem = next) {
+			struct shash_elem **b = shash_bucket(hash, elem->key);
+
+			next = elem->next;
+			elem->next = *b;
+			*b = elem;
+		}
+
+	free(old);
+}
+
 void *shash_insert(struct simple_hash *hash, const void *key, void *data)
 {
-	struct shash_elem *elem;
+	struct shash_elem **b = shash_bucket(hash, key), *elem;
 	void *old;
 
-	for (elem = hash->elem; elem; elem = elem->next) {
+	for (elem = *b; elem; elem = elem->next) {
 		if (!hash->eqfn(elem->key, key)) {
 			old = elem->data;
 			elem->data = data;
@@ -64,22 +110,24 @@ void *shash_insert(struct simple_hash *hash, const void *key, void *data)
 	}
 
 	elem = calloc(1, sizeof(*elem));
+	if (!elem)
+		return NULL;
 	elem->key = key;
 	elem->data = data;
+	elem->next = *b;
+	*b = elem;
 
-	elem->next = hash->elem;
-	elem->prev = &hash->elem;
-	hash->elem = elem;
-	if (elem->next)
-		elem->next->prev = &elem->next;
+	if (++hash->count > hash->mask + 1)
+		shash_grow(hash);
 
 	return NULL;
 }
+
 void *shash_get(struct simple_hash *hash, const void *key)
 {
 	struct shash_elem *elem;
 
-	for (elem = hash->elem; elem; elem = elem->next) {
+	for (elem = *shash_bucket(hash, key); elem; elem = elem->next) {
 		if (!hash->eqfn(elem->key, key)) {
 			return elem->data;
 		}
@@ -87,15 +135,55 @@ void *shash_get(struct simple_hash *hash, const void *key)
 
 	return NULL;
 }
+
 void *shash_drop(struct simple_hash *hash, const void *key)
 {
-	struct shash_elem *elem;
+	struct shash_elem **p, *elem;
+	void *data;
 
-	for (elem = hash->elem; elem; elem = elem->next) {
+	for (p = shash_bucket(hash, key); (elem = *p); p = &elem->next) {
 		if (!hash->eqfn(elem->key, key)) {
-			*(elem->prev) = elem->next;
+			*p = elem->next;
+			data = elem->data;
+			free(elem);
+			hash->count--;
+			return data;
 		}
 	}
 
-	return elem;
+	return NULL;
+}
+
+void shash_for_each(struct simple_hash *hash, shash_iter fn, void *arg)
+{
+	struct shash_elem *elem, *next;
+	unsigned int i;
+
+	for (i = 0; i <= hash->mask; i++)
+		for (elem = hash->buckets[i]; elem; elem = next) {
+			next = elem->next;
+			fn(elem->key, elem->data, arg);
+		}
+}
+
+unsigned int shash_count(struct simple_hash *hash)
+{
+	return hash->count;
+}
+
+unsigned int hw_hash(const void *key)
+{
+	const unsigned char *hwa = key;
+	unsigned int val = 0;
+	int i;
+
+	for (i = 0; i < IEEE802154_ADDR_LEN; i++)
+		val = val * 31 + hwa[i];
+
+	return val;
+}
+
+int hw_eq(const void *key1, const void *key2)
+{
+	return memcmp(key1, key2, IEEE802154_ADDR_LEN);
 }
@@ -0,0 +1,470 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Admission lists for izcoordinator: which EUI-64s may associate.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/* Bloom filter size per listed address, and probes per lookup */
+#define ACL_BLOOM_BITS_PER_KEY	16
+#define ACL_BLOOM_PROBES	4
+
+/*
+ * A list lives in one anonymous mapping: this header, the Bloom filter
+ * words, then the sorted keys. A device that is not on the list is
+ * nearly always turned away by the filter alone; only listed devices
+ * and the odd false positive pay for the binary search.
+ */
+struct acl_list {
+	size_t map_size;
+	uint64_t nkeys;
+	uint64_t bloom_mask;	/* in bits */
+	uint64_t *bloom;
+	uint64_t *keys;
+};
+
+enum {
+	ACL_ALLOW,
+	ACL_DENY,
+	__ACL_MAX,
+};
+
+static const char *const acl_name[__ACL_MAX] = {
+	[ACL_ALLOW] = "allow",
+	[ACL_DENY] = "deny",
+};
+
+/* Only ever replaced from the loop, so lookups need no locking */
+static struct acl_list *lists[__ACL_MAX];
+
+/* Background reload: next_path is what to load, reload_path is the thread's copy */
+static char next_path[__ACL_MAX][PATH_MAX];
+static char reload_path[__ACL_MAX][PATH_MAX];
+static struct acl_list *reload_result[__ACL_MAX];
+static int reload_err;
+static pthread_t reload_thread;
+static int reload_running, reload_again;
+static int done_fd[2] = { -1, -1 };
+
+static uint64_t acl_key(const uint8_t *hwa)
+{
+	uint64_t key = 0;
+	int i;
+
+	for (i = 0; i < IEEE802154_ADDR_LEN; i++)
+		key = key << 8 | hwa[i];
+
+	return key;
+}
+
+/* splitmix64 finalizer; two halves give the double hashing probes */
+static uint64_t acl_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static int acl_bloom_test(const struct acl_list *l, uint64_t key, int set)
+{
+	uint64_t h = acl_mix(key);
+	uint64_t h1 = h, h2 = (h >> 32) | 1;
+	int i;
+
+	for (i = 0; i < ACL_BLOOM_PROBES; i++) {
+		uint64_t bit = (h1 + i * h2) & l->bloom_mask;
+
+		if (set)
+			l->bloom[bit / 64] |= 1ULL << (bit % 64);
+		else if (!(l->bloom[bit / 64] & (1ULL << (bit % 64))))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int acl_contains(const struct acl_list *l, const uint8_t *hwa)
+{
+	uint64_t key = acl_key(hwa);
+	uint64_t lo = 0, hi = l->nkeys;
+
+	if (!acl_bloom_test(l, key, 0))
+		return 0;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (l->keys[mid] == key)
+			return 1;
+		if (l->keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+int coord_acl_admit(const uint8_t *hwa)
+{
+	if (lists[ACL_DENY] && acl_contains(lists[ACL_DENY], hwa))
+		return 0;
+	if (lists[ACL_ALLOW] && !acl_contains(lists[ACL_ALLOW], hwa))
+		return 0;
+
+	return 1;
+}
+
+static void acl_free(struct acl_list *l)
+{
+	if (l)
+		munmap(l, l->map_size);
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int acl_parse_line(char *line, uint64_t *key)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	char *p;
+	int n;
+
+	if ((p = strchr(line, '#')))
+		*p = '\0';
+	for (p = line; *p == ' ' || *p == '\t'; p++)
+		;
+	if (!*p || *p == '\n')
+		return 0;
+
+	n = parse_hwaddr(p, hwa);
+	if (n < 0)
+		return -1;
+	for (p += n; isspace((unsigned char)*p); p++)
+		;
+	if (*p)
+		return -1;
+
+	*key = acl_key(hwa);
+
+	return 1;
+}
+
+/* One EUI-64 per line, written like in the lease file; '#' comments */
+static int acl_build(const char *path, struct acl_list **res)
+{
+	uint64_t *keys = NULL, nkeys = 0, size = 0, i, j, bits;
+	struct acl_list *l;
+	char line[128];
+	size_t map_size;
+	int lineno = 0, err = 0;
+	void *map;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = -errno;
+		log_msg(0, "acl: can't open %s: %s\n", path, strerror(errno));
+		return err;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		uint64_t key;
+		int ret;
+
+		lineno++;
+		ret = acl_parse_line(line, &key);
+		if (ret < 0) {
+			log_msg(0, "acl: %s:%d: not an EUI-64\n", path, lineno);
+			err = -EINVAL;
+			break;
+		}
+		if (!ret)
+			continue;
+
+		if (nkeys == size) {
+			uint64_t *n;
+
+			size = size ? size * 2 : 1024;
+			n = realloc(keys, size * sizeof(*keys));
+			if (!n) {
+				err = -ENOMEM;
+				break;
+			}
+			keys = n;
+		}
+		keys[nkeys++] = key;
+	}
+	fclose(f);
+	if (err < 0)
+		goto out;
+
+	qsort(keys, nkeys, sizeof(*keys), cmp_key);
+	for (i = j = 0; i < nkeys; i++)
+		if (!j || keys[i] != keys[j - 1])
+			keys[j++] = keys[i];
+	nkeys = j;
+
+	for (bits = 64; bits < nkeys * ACL_BLOOM_BITS_PER_KEY; bits *= 2)
+		;
+
+	map_size = sizeof(*l) + bits / 8 + nkeys * sizeof(*keys);
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		err = -errno;
+		goto out;
+	}
+
+	l = map;
+	l->map_size = map_size;
+	l->nkeys = nkeys;
+	l->bloom_mask = bits - 1;
+	l->bloom = (uint64_t *)(l + 1);
+	l->keys = l->bloom + bits / 64;
+	memcpy(l->keys, keys, nkeys * sizeof(*keys));
+	for (i = 0; i < nkeys; i++)
+		acl_bloom_test(l, keys[i], 1);
+
+	/* Read-only from now on, like a list mapped from a file */
+	mprotect(map, map_size, PROT_READ);
+	*res = l;
+
+out:
+	free(keys);
+	return err;
+}
+
+static int acl_build_all(const char paths[__ACL_MAX][PATH_MAX],
+		struct acl_list *res[__ACL_MAX])
+{
+	int i, err;
+
+	for (i = 0; i < __ACL_MAX; i++) {
+		res[i] = NULL;
+		if (!paths[i][0])
+			continue;
+		err = acl_build(paths[i], &res[i]);
+		if (err < 0) {
+			while (i--)
+				acl_free(res[i]);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static void acl_install(struct acl_list *res[__ACL_MAX])
+{
+	int i;
+
+	for (i = 0; i < __ACL_MAX; i++) {
+		acl_free(lists[i]);
+		lists[i] = res[i];
+		if (lists[i])
+			log_msg(0, "acl: %s list of %llu devices\n", acl_name[i],
+					(unsigned long long)lists[i]->nkeys);
+	}
+}
+
+static int acl_set_paths(const char *allow, const char *deny)
+{
+	if (strlen(allow) >= PATH_MAX || strlen(deny) >= PATH_MAX)
+		return -ENAMETOOLONG;
+
+	strcpy(next_path[ACL_ALLOW], allow);
+	strcpy(next_path[ACL_DENY], deny);
+
+	return 0;
+}
+
+/* At start up: nothing may associate before the lists are in place */
+int coord_acl_load(const char *allow, const char *deny)
+{
+	struct acl_list *res[__ACL_MAX];
+	int err;
+
+	err = acl_set_paths(allow, deny);
+	if (err < 0)
+		return err;
+
+	err = acl_build_all(next_path, res);
+	if (err < 0)
+		return err;
+
+	acl_install(res);
+
+	return 0;
+}
+
+static void *acl_reload_main(void *arg)
+{
+	char c = 0;
+
+	reload_err = acl_build_all(reload_path, reload_result);
+	if (write(done_fd[1], &c, 1) < 0)
+		log_msg(0, "acl: can't signal reload: %s\n", strerror(errno));
+
+	return NULL;
+}
+
+static int acl_reload_start(void)
+{
+	sigset_t all, old;
+	int err;
+
+	memcpy(reload_path, next_path, sizeof(reload_path));
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&reload_thread, NULL, acl_reload_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err)
+		return -err;
+
+	reload_running = 1;
+	return 0;
+}
+
+static void acl_done_cb(int fd, short revents, void *arg)
+{
+	char buf[16];
+
+	if (read(fd, buf, sizeof(buf)) <= 0)
+		return;
+
+	pthread_join(reload_thread, NULL);
+	reload_running = 0;
+
+	if (reload_err < 0)
+		log_msg(0, "acl: reload failed, keeping the old lists: %s\n",
+				strerror(-reload_err));
+	else
+		acl_install(reload_result);
+
+	if (reload_again) {
+		reload_again = 0;
+		if (acl_reload_start() < 0)
+			log_msg(0, "acl: can't start reload\n");
+	}
+}
+
+/*
+ * Lists are read and sorted by a helper thread, associations go on
+ * against the old lists until the new ones are swapped in.
+ */
+int coord_acl_reload(const char *allow, const char *deny)
+{
+	int err;
+
+	if (done_fd[0] < 0) {
+		if (pipe2(done_fd, O_CLOEXEC | O_NONBLOCK))
+			return -errno;
+		err = coord_loop_add(done_fd[0], POLLIN, acl_done_cb, NULL);
+		if (err < 0) {
+			/* Nobody would collect the thread: try again next time */
+			close(done_fd[0]);
+			close(done_fd[1]);
+			done_fd[0] = done_fd[1] = -1;
+			return err;
+		}
+	}
+
+	err = acl_set_paths(allow, deny);
+	if (err < 0)
+		return err;
+
+	/* Files may have changed after the running one read them */
+	if (reload_running) {
+		reload_again = 1;
+		return 0;
+	}
+
+	return acl_reload_start();
+}
+
+/* At exit: the reload thread logs, so it has to be gone before logging is */
+void coord_acl_stop(void)
+{
+	int i;
+
+	if (!reload_running)
+		return;
+
+	pthread_join(reload_thread, NULL);
+	reload_running = 0;
+	reload_again = 0;
+	if (reload_err < 0)
+		return;
+	for (i = 0; i < __ACL_MAX; i++) {
+		acl_free(reload_result[i]);
+		reload_result[i] = NULL;
+	}
+}
+
+static int acl_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < __ACL_MAX; i++)
+		if (lists[i])
+			coord_ctl_printf(c, "%s %llu\n", acl_name[i],
+					(unsigned long long)lists[i]->nkeys);
+		else
+			coord_ctl_printf(c, "%s off\n", acl_name[i]);
+	if (reload_running)
+		coord_ctl_printf(c, "reloading\n");
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_acl_ctl = {
+	.name = "acl",
+	.commands = {
+	{
+		.name	= "acl",
+		.usage	= "",
+		.call	= acl_cmd,
+	},
+	{}}
+};
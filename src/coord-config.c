@@ -0,0 +1,201 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * izcoordinator configuration file, read at start and on every reload.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/*
+ * One "key value" pair per line, '#' starts a comment. Keys that are
+ * left out keep the value given on the command line.
+ */
+
+/* 0xfffe and 0xffff are not addresses a device can be given */
+static int config_u16(const char *val, int *res)
+{
+	char *end;
+	long v = strtol(val, &end, 16);
+
+	if (*end || end == val || v < 0 || v > ADDRDB_SHORT_MAX)
+		return -1;
+	*res = v;
+	return 0;
+}
+
+int coord_config_parse_tree(const char *arg, struct coord_config *cfg)
+{
+	unsigned int cm, rm, lm;
+	int n;
+
+	if (sscanf(arg, "%u:%u:%u%n", &cm, &rm, &lm, &n) != 3 || arg[n] ||
+	    !cm || rm > cm || !lm)
+		return -1;
+
+	cfg->tree_cm = cm;
+	cfg->tree_rm = rm;
+	cfg->tree_lm = lm;
+	return 0;
+}
+
+int coord_config_parse_beacon(const char *arg, struct coord_config *cfg)
+{
+	unsigned int bo, so;
+	int n;
+
+	if (sscanf(arg, "%u:%u%n", &bo, &so, &n) != 2 || arg[n] ||
+	    bo > 15 || so > bo || (bo == 15 && so != 15))
+		return -1;
+
+	cfg->bcn_ord = bo;
+	cfg->sf_ord = so;
+	return 0;
+}
+
+static int config_line(struct coord_config *cfg, char *key, char *val)
+{
+	char *end;
+
+	if (!strcmp(key, "range_min"))
+		return config_u16(val, &cfg->range_min);
+	if (!strcmp(key, "range_max"))
+		return config_u16(val, &cfg->range_max);
+	if (!strcmp(key, "debug")) {
+		cfg->debug = strtol(val, &end, 0);
+		return *end ? -1 : 0;
+	}
+	if (!strcmp(key, "lease_file")) {
+		if (strlen(val) >= sizeof(cfg->lease_file))
+			return -1;
+		strcpy(cfg->lease_file, val);
+		return 0;
+	}
+	if (!strcmp(key, "ratelimit"))
+		return coord_ratelimit_parse(val, &cfg->dev_rate, &cfg->dev_burst);
+	if (!strcmp(key, "global_ratelimit"))
+		return coord_ratelimit_parse(val, &cfg->global_rate, &cfg->global_burst);
+	if (!strcmp(key, "response_budget")) {
+		cfg->resp_budget_us = strtoul(val, &end, 0);
+		return *end ? -1 : 0;
+	}
+	if (!strcmp(key, "allow_list") || !strcmp(key, "deny_list")) {
+		char *dst = key[0] == 'a' ? cfg->allow_list : cfg->deny_list;
+
+		if (strlen(val) >= PATH_MAX)
+			return -1;
+		strcpy(dst, val);
+		return 0;
+	}
+	if (!strcmp(key, "tree"))
+		return coord_config_parse_tree(val, cfg);
+	if (!strcmp(key, "beacon"))
+		return coord_config_parse_beacon(val, cfg);
+	if (!strcmp(key, "dedup_window")) {
+		cfg->dedup_window_ms = strtoul(val, &end, 0);
+		return *end ? -1 : 0;
+	}
+
+	return -1;
+}
+
+/* Fills in cfg on top of what it holds; leaves it alone on any error */
+int coord_config_load(const char *path, struct coord_config *cfg)
+{
+	struct coord_config tmp = *cfg;
+	char line[PATH_MAX + 64];
+	int lineno = 0, err = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		log_msg(0, "config: can't open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *key, *val, *p;
+
+		lineno++;
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+
+		key = line;
+		while (isspace((unsigned char)*key))
+			key++;
+		if (!*key)
+			continue;
+		for (val = key; *val && !isspace((unsigned char)*val); val++)
+			;
+		if (*val)
+			*val++ = '\0';
+		while (isspace((unsigned char)*val))
+			val++;
+		for (p = val + strlen(val); p > val && isspace((unsigned char)p[-1]); p--)
+			;
+		*p = '\0';
+
+		if (config_line(&tmp, key, val)) {
+			log_msg(0, "config: %s:%d: bad setting '%s'\n", path, lineno, key);
+			err = -EINVAL;
+		}
+	}
+	fclose(f);
+
+	if (!err && tmp.range_min > tmp.range_max) {
+		log_msg(0, "config: %s: range_min is above range_max\n", path);
+		err = -EINVAL;
+	}
+	if (err)
+		return err;
+
+	*cfg = tmp;
+	return 0;
+}
+
+static int reload_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	int err = coord_reload();
+
+	if (err < 0)
+		return coord_ctl_error(c, err == -EINVAL ?
+				"bad configuration, see the log" : strerror(-err));
+
+	return coord_ctl_printf(c, "ok\n");
+}
+
+const struct coord_ctl_module coord_config_ctl = {
+	.name = "config",
+	.commands = {
+	{
+		.name	= "reload",
+		.usage	= "",
+		.call	= reload_cmd,
+	},
+	{}}
+};
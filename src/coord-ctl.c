@@ -0,0 +1,528 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Local control socket of izcoordinator.
+ *
+ * The protocol is line based: a client sends one command per line and
+ * gets the answer followed by an empty line. Errors are reported as a
+ * single "error: ..." line, also followed by an empty line.
+ *
+ * Standbys may also connect over TCP; those clients only get the
+ * commands that read leases.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <logging.h>
+
+#include "coordinator.h"
+
+#define CTL_LINE_MAX	256
+#define CTL_ARGS_MAX	16
+#define CTL_BACKLOG	8
+
+extern const struct coord_ctl_module coord_metrics_ctl;
+extern const struct coord_ctl_module coord_handoff_ctl;
+extern const struct coord_ctl_module coord_config_ctl;
+extern const struct coord_ctl_module coord_leases_ctl;
+extern const struct coord_ctl_module coord_feed_ctl;
+extern const struct coord_ctl_module coord_acl_ctl;
+extern const struct coord_ctl_module coord_standby_ctl;
+extern const struct coord_ctl_module coord_gts_ctl;
+extern const struct coord_ctl_module coord_indirect_ctl;
+
+static const struct coord_ctl_module *ctl_modules[] = {
+	&coord_metrics_ctl,
+	&coord_handoff_ctl,
+	&coord_config_ctl,
+	&coord_leases_ctl,
+	&coord_feed_ctl,
+	&coord_acl_ctl,
+	&coord_standby_ctl,
+	&coord_gts_ctl,
+	&coord_indirect_ctl,
+	NULL
+};
+
+static int listen_fd = -1, tcp_fd = -1;
+static const char *ctl_path;
+static struct coord_ctl_client *clients;
+
+static void ctl_client_cb(int fd, short revents, void *arg);
+
+static const struct coord_ctl_cmd *ctl_get_cmd(const char *name)
+{
+	int i, j;
+
+	for (i = 0; ctl_modules[i]; i++)
+		for (j = 0; ctl_modules[i]->commands[j].name; j++)
+			if (!strcmp(name, ctl_modules[i]->commands[j].name))
+				return &ctl_modules[i]->commands[j];
+
+	return NULL;
+}
+
+int coord_ctl_printf(struct coord_ctl_client *c, const char *fmt, ...)
+{
+	va_list ap;
+	char *out;
+	int n;
+
+	while (1) {
+		size_t room = c->out_size - c->out_len;
+
+		va_start(ap, fmt);
+		n = vsnprintf(c->out + c->out_len, room, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return n;
+		if ((size_t)n < room)
+			break;
+
+		room = c->out_size ? c->out_size * 2 : 4096;
+		while (room < c->out_len + n + 1)
+			room *= 2;
+		out = realloc(c->out, room);
+		if (!out)
+			return -ENOMEM;
+		c->out = out;
+		c->out_size = room;
+	}
+	c->out_len += n;
+
+	return n;
+}
+
+int coord_ctl_error(struct coord_ctl_client *c, const char *msg)
+{
+	coord_ctl_printf(c, "error: %s\n", msg);
+	return -EINVAL;
+}
+
+static void ctl_client_free(struct coord_ctl_client *c)
+{
+	struct coord_ctl_client **p;
+
+	for (p = &clients; *p; p = &(*p)->next)
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+
+	if (c->release)
+		c->release(c);
+	coord_loop_del(c->fd);
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+static void ctl_help(struct coord_ctl_client *c)
+{
+	int i, j;
+
+	for (i = 0; ctl_modules[i]; i++)
+		for (j = 0; ctl_modules[i]->commands[j].name; j++)
+			coord_ctl_printf(c, "%s %s\n",
+					ctl_modules[i]->commands[j].name,
+					ctl_modules[i]->commands[j].usage);
+}
+
+static void ctl_exec(struct coord_ctl_client *c, char *line)
+{
+	char *argv[CTL_ARGS_MAX + 1];
+	const struct coord_ctl_cmd *cmd;
+	char *save = NULL;
+	int argc = 0;
+
+	while (argc < CTL_ARGS_MAX &&
+	       (argv[argc] = strtok_r(argc ? NULL : line, " \t\r", &save)))
+		argc++;
+	argv[argc] = NULL;
+
+	if (!argc)
+		return;
+
+	if (!strcmp(argv[0], "help")) {
+		ctl_help(c);
+	} else if (!(cmd = ctl_get_cmd(argv[0]))) {
+		coord_ctl_error(c, "unknown command");
+	} else if (c->remote && !cmd->remote) {
+		coord_ctl_error(c, "not allowed over TCP");
+	} else {
+		cmd->call(c, argc, argv);
+		/* Streaming commands terminate their own output */
+		if (c->more)
+			return;
+	}
+	coord_ctl_printf(c, "\n");
+}
+
+/* Try to push out the output buffer; refill it from a streaming command */
+static int ctl_flush(struct coord_ctl_client *c)
+{
+	int idle = 0;
+	ssize_t n;
+
+	while (1) {
+		if (c->out_off == c->out_len) {
+			c->out_off = c->out_len = 0;
+			if (!c->more)
+				break;
+			if (!c->more(c)) {
+				c->more = NULL;
+				coord_ctl_printf(c, "\n");
+			} else if (!c->out_len) {
+				/* Nothing yet, coord_ctl_wake() restarts it */
+				idle = 1;
+				break;
+			}
+			continue;
+		}
+
+		n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -errno;
+		}
+		c->out_off += n;
+	}
+
+	/* No reading while streaming, the next command has to wait anyway */
+	if (c->more)
+		coord_loop_set_events(c->fd, idle ? 0 : POLLOUT);
+	else
+		coord_loop_set_events(c->fd, POLLIN | (c->out_len ? POLLOUT : 0));
+
+	return 0;
+}
+
+/* A streaming command that ran dry has something to send again */
+void coord_ctl_wake(struct coord_ctl_client *c)
+{
+	coord_loop_set_events(c->fd, POLLOUT);
+}
+
+/*
+ * Run the commands received so far and send their answers. Commands
+ * queued behind a streaming one wait until its output is complete.
+ */
+static int ctl_serve(struct coord_ctl_client *c)
+{
+	char *nl;
+
+	do {
+		while (!c->more && (nl = strchr(c->in, '\n'))) {
+			*nl = '\0';
+			ctl_exec(c, c->in);
+			c->in_len -= nl + 1 - c->in;
+			memmove(c->in, nl + 1, c->in_len + 1);
+		}
+		if (ctl_flush(c) < 0)
+			return -1;
+	} while (!c->more && strchr(c->in, '\n'));
+
+	return 0;
+}
+
+static void ctl_client_cb(int fd, short revents, void *arg)
+{
+	struct coord_ctl_client *c = arg;
+	ssize_t n;
+
+	if (revents & POLLOUT) {
+		if (ctl_serve(c) < 0) {
+			ctl_client_free(c);
+			return;
+		}
+	}
+
+	if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+		return;
+
+	n = recv(fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (n <= 0) {
+		ctl_client_free(c);
+		return;
+	}
+	c->in_len += n;
+	c->in[c->in_len] = '\0';
+
+	if (ctl_serve(c) < 0) {
+		ctl_client_free(c);
+		return;
+	}
+
+	if (c->in_len == sizeof(c->in) - 1 && !strchr(c->in, '\n')) {
+		coord_ctl_error(c, "line too long");
+		c->in_len = 0;
+		c->in[0] = '\0';
+		if (ctl_flush(c) < 0)
+			ctl_client_free(c);
+	}
+}
+
+static void ctl_accept_cb(int fd, short revents, void *arg)
+{
+	struct coord_ctl_client *c;
+	int cfd;
+
+	cfd = accept(fd, NULL, NULL);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			log_msg(0, "ctl: accept: %s\n", strerror(errno));
+		return;
+	}
+	fcntl(cfd, F_SETFD, FD_CLOEXEC);
+
+	c = calloc(1, sizeof(*c));
+	if (!c || coord_loop_add(cfd, POLLIN, ctl_client_cb, c)) {
+		free(c);
+		close(cfd);
+		return;
+	}
+	c->fd = cfd;
+	if (fd == tcp_fd) {
+		int one = 1;
+
+		/* Lease changes are small and should go out right away */
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		c->remote = 1;
+	}
+	c->next = clients;
+	clients = c;
+}
+
+/*
+ * A socket nobody listens on is left over from a previous run and goes.
+ * One that answers belongs to a live instance: a standby pointed at the
+ * primary's socket must not take it over.
+ */
+static int ctl_check_stale(const struct sockaddr_un *addr)
+{
+	int fd, err = 0;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (!connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) ||
+	    errno == EAGAIN || errno == EINPROGRESS)
+		err = -EADDRINUSE;
+	else if (errno == ECONNREFUSED)
+		unlink(addr->sun_path);
+	close(fd);
+
+	return err;
+}
+
+int coord_ctl_init(const char *path)
+{
+	struct sockaddr_un addr;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return -errno;
+	fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	err = ctl_check_stale(&addr);
+	if (err < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return err;
+	}
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    chmod(path, 0660) < 0 ||
+	    listen(listen_fd, CTL_BACKLOG) < 0) {
+		err = -errno;
+		close(listen_fd);
+		listen_fd = -1;
+		return err;
+	}
+	ctl_path = path;
+
+	return coord_loop_add(listen_fd, POLLIN, ctl_accept_cb, NULL);
+}
+
+/*
+ * "host:port", "[v6addr]:port" or, with passive set, just "port". What
+ * TCP clients may read is not authenticated, so a bare port only listens
+ * on 127.0.0.1; "*:port" listens on all local addresses.
+ */
+int coord_ctl_resolve(const char *arg, int passive,
+		struct sockaddr_storage *ss, socklen_t *len)
+{
+	struct addrinfo hints, *res;
+	char host[256];
+	const char *port = strrchr(arg, ':');
+	size_t n;
+	int err;
+
+	if (!port) {
+		if (!passive)
+			return -EINVAL;
+		host[0] = '\0';
+		port = arg;
+	} else {
+		n = port - arg;
+		if (n >= 2 && arg[0] == '[' && arg[n - 1] == ']') {
+			arg++;
+			n -= 2;
+		}
+		if (n >= sizeof(host))
+			return -ENAMETOOLONG;
+		memcpy(host, arg, n);
+		host[n] = '\0';
+		port++;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (passive && !strcmp(host, "*")) {
+		hints.ai_flags = AI_PASSIVE;
+		host[0] = '\0';
+	} else if (!host[0]) {
+		hints.ai_family = AF_INET;	/* 127.0.0.1 */
+	}
+
+	err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+	if (err) {
+		log_msg(0, "ctl: %s: %s\n", arg, gai_strerror(err));
+		return -EINVAL;
+	}
+	memcpy(ss, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/* Where standbys connect to follow our leases */
+int coord_ctl_listen_tcp(const char *arg)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int one = 1, err;
+
+	err = coord_ctl_resolve(arg, 1, &ss, &len);
+	if (err < 0)
+		return err;
+
+	tcp_fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (tcp_fd < 0)
+		return -errno;
+	setsockopt(tcp_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(tcp_fd, (struct sockaddr *)&ss, len) < 0 ||
+	    listen(tcp_fd, CTL_BACKLOG) < 0) {
+		err = -errno;
+		close(tcp_fd);
+		tcp_fd = -1;
+		return err;
+	}
+
+	return coord_loop_add(tcp_fd, POLLIN, ctl_accept_cb, NULL);
+}
+
+/* Serve on a listening socket handed over by a previous instance */
+int coord_ctl_adopt(int fd, const char *path)
+{
+	listen_fd = fd;
+	fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+	ctl_path = path;
+
+	return coord_loop_add(listen_fd, POLLIN, ctl_accept_cb, NULL);
+}
+
+int coord_ctl_listen_fd(void)
+{
+	return listen_fd;
+}
+
+static void ctl_close_tcp(void)
+{
+	if (tcp_fd < 0)
+		return;
+
+	coord_loop_del(tcp_fd);
+	close(tcp_fd);
+	tcp_fd = -1;
+}
+
+/*
+ * The socket lives on in another process: stop accepting, keep the
+ * path. The TCP port is not handed over, so it is freed for the
+ * successor to bind.
+ */
+void coord_ctl_detach(void)
+{
+	ctl_close_tcp();
+
+	if (listen_fd < 0)
+		return;
+
+	coord_loop_del(listen_fd);
+	close(listen_fd);
+	listen_fd = -1;
+}
+
+void coord_ctl_close(void)
+{
+	/* Last changes for subscribers, as far as their sockets take them */
+	while (clients) {
+		ctl_flush(clients);
+		ctl_client_free(clients);
+	}
+	ctl_close_tcp();
+
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(ctl_path);
+		listen_fd = -1;
+	}
+}
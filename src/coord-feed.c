@@ -0,0 +1,262 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Lease change feed: control socket clients subscribe and are sent
+ * every lease change as it happens.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <ieee802154.h>
+#include <addrdb.h>
+
+#include "coordinator.h"
+
+/*
+ * Changes kept for subscribers that are behind or reconnect. Must stay
+ * a power of two. A subscriber that falls further back than this is
+ * sent a new snapshot.
+ */
+#define FEED_HISTORY	4096
+/* Leases or changes formatted per refill of a subscriber's output */
+#define FEED_CHUNK	64
+/* How often an idle subscriber hears from us, so it can tell we're alive */
+#define FEED_ALIVE_MS	200
+
+/*
+ * Protocol, one line each:
+ *   snapshot EPOCH SEQ       a full table follows, as of change SEQ
+ *   lease HWADDR SHORT STAMP one lease of the snapshot
+ *   sync SEQ                 end of the snapshot
+ *   SEQ add|refresh|del HWADDR SHORT STAMP
+ *   alive SEQ                nothing new after SEQ, sent every FEED_ALIVE_MS
+ * "subscribe EPOCH SEQ" resumes after change SEQ if it is still
+ * known; the epoch changes whenever izcoordinator is restarted.
+ */
+
+struct feed_event {
+	uint64_t seq;
+	uint8_t ev;
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	time_t stamp;
+};
+
+enum feed_state {
+	FEED_SNAPSHOT,
+	FEED_LIVE,
+};
+
+struct feed_sub {
+	struct coord_ctl_client *c;
+	enum feed_state state;
+	unsigned int walk;	/* next short address of the snapshot */
+	uint64_t sent;		/* last change sent */
+	int alive;		/* due for an alive line */
+	struct feed_sub *next;
+};
+
+static struct feed_event history[FEED_HISTORY];
+/* Last change recorded; changes are numbered from 1 */
+static uint64_t feed_seq;
+static unsigned long long feed_epoch;
+static struct feed_sub *subs;
+static struct coord_timer alive_timer;
+
+static const char *const ev_name[] = {
+	[ADDRDB_LEASE_ADD] = "add",
+	[ADDRDB_LEASE_REFRESH] = "refresh",
+	[ADDRDB_LEASE_DEL] = "del",
+};
+
+static unsigned long long feed_get_epoch(void)
+{
+	if (!feed_epoch) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		feed_epoch = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	return feed_epoch;
+}
+
+void coord_feed_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp)
+{
+	struct feed_event *e = &history[++feed_seq & (FEED_HISTORY - 1)];
+	struct feed_sub *s;
+
+	e->seq = feed_seq;
+	e->ev = ev;
+	memcpy(e->hwaddr, hwa, IEEE802154_ADDR_LEN);
+	e->short_addr = short_addr;
+	e->stamp = stamp;
+
+	for (s = subs; s; s = s->next)
+		coord_ctl_wake(s->c);
+}
+
+static void feed_print_lease(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	coord_ctl_printf(arg, "lease %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x 0x%04x %ld\n",
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7],
+			short_addr, (long)stamp);
+}
+
+static void feed_print_event(struct coord_ctl_client *c, const struct feed_event *e)
+{
+	const uint8_t *hwa = e->hwaddr;
+
+	coord_ctl_printf(c, "%llu %s %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x 0x%04x %ld\n",
+			(unsigned long long)e->seq, ev_name[e->ev],
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7],
+			e->short_addr, (long)e->stamp);
+}
+
+/*
+ * Changes made while the snapshot is streamed are sent after it, so
+ * applying them on top of the snapshot gives the current table.
+ */
+static void feed_snapshot(struct feed_sub *s)
+{
+	s->state = FEED_SNAPSHOT;
+	s->walk = 0;
+	s->sent = feed_seq;
+	coord_ctl_printf(s->c, "snapshot %llx %llu\n",
+			feed_get_epoch(), (unsigned long long)feed_seq);
+}
+
+static int feed_more(struct coord_ctl_client *c)
+{
+	struct feed_sub *s = c->priv;
+	int n;
+
+	if (s->state == FEED_SNAPSHOT) {
+		s->walk = addrdb_walk(s->walk, FEED_CHUNK, feed_print_lease, c);
+		if (s->walk < 0x10000)
+			return 1;
+		coord_ctl_printf(c, "sync %llu\n", (unsigned long long)s->sent);
+		s->state = FEED_LIVE;
+	}
+
+	if (feed_seq - s->sent > FEED_HISTORY) {
+		coord_count(COORD_CNT_FEED_OVERRUN);
+		feed_snapshot(s);
+		return 1;
+	}
+
+	for (n = 0; n < FEED_CHUNK && s->sent < feed_seq; n++)
+		feed_print_event(c, &history[++s->sent & (FEED_HISTORY - 1)]);
+
+	if (s->alive) {
+		s->alive = 0;
+		if (!n)
+			coord_ctl_printf(c, "alive %llu\n", (unsigned long long)s->sent);
+	}
+
+	return 1;
+}
+
+static void feed_alive(void *arg)
+{
+	struct feed_sub *s;
+
+	for (s = subs; s; s = s->next) {
+		s->alive = 1;
+		coord_ctl_wake(s->c);
+	}
+
+	if (subs)
+		coord_timer_add(&alive_timer, FEED_ALIVE_MS);
+}
+
+static void feed_release(struct coord_ctl_client *c)
+{
+	struct feed_sub **p, *s = c->priv;
+
+	for (p = &subs; *p; p = &(*p)->next)
+		if (*p == s) {
+			*p = s->next;
+			break;
+		}
+	free(s);
+}
+
+static int subscribe_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	unsigned long long epoch = 0, seq = 0;
+	struct feed_sub *s;
+	char *end;
+
+	if (argc == 3) {
+		epoch = strtoull(argv[1], &end, 16);
+		if (*end)
+			return coord_ctl_error(c, "bad epoch");
+		seq = strtoull(argv[2], &end, 10);
+		if (*end)
+			return coord_ctl_error(c, "bad sequence number");
+	} else if (argc != 1) {
+		return coord_ctl_error(c, "usage: subscribe [epoch seq]");
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return coord_ctl_error(c, "out of memory");
+	s->c = c;
+	s->next = subs;
+	if (!subs) {
+		alive_timer.cb = feed_alive;
+		coord_timer_add(&alive_timer, FEED_ALIVE_MS);
+	}
+	subs = s;
+
+	c->priv = s;
+	c->more = feed_more;
+	c->release = feed_release;
+
+	if (argc == 3 && epoch == feed_get_epoch() &&
+	    seq <= feed_seq && feed_seq - seq <= FEED_HISTORY) {
+		s->state = FEED_LIVE;
+		s->sent = seq;
+		coord_ctl_printf(c, "sync %llu\n", seq);
+	} else {
+		feed_snapshot(s);
+	}
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_feed_ctl = {
+	.name = "feed",
+	.commands = {
+	{
+		.name	= "subscribe",
+		.usage	= "[epoch seq]",
+		.call	= subscribe_cmd,
+		.remote	= 1,
+	},
+	{}}
+};
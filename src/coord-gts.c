@@ -0,0 +1,435 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Guaranteed time slots: hand out the contention-free period at the
+ * end of each superframe of a beacon-enabled PAN.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <ieee802154.h>
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+#define GTS_SLOTS		16	/* aNumSuperframeSlots */
+#define GTS_MAX			7	/* descriptors a beacon can carry */
+#define GTS_BASE_SLOT		60	/* aBaseSlotDuration, symbols */
+#define GTS_MIN_CAP		440	/* aMinCAPLength, symbols */
+
+/*
+ * The slots of the CFP are given out in deadline order, earliest first,
+ * and packed against the end of the superframe. Equal deadlines keep
+ * the order the requests came in, so a sequence of requests always
+ * ends up in the same slot map.
+ */
+struct gts {
+	uint16_t short_addr;
+	uint8_t rx;		/* device receives */
+	uint8_t len;		/* slots */
+	uint8_t deadline;	/* slot it has to end by, GTS_SLOTS: any */
+	uint8_t start;
+	unsigned long order;
+};
+
+static struct gts gts[GTS_MAX];
+static unsigned int ngts;
+static unsigned int bcn_ord = 15, sf_ord = 15;
+static unsigned long next_order;
+
+/* Longest CFP that still leaves aMinCAPLength of contention access */
+static unsigned int gts_cfp_max(void)
+{
+	unsigned int slot, cap;
+
+	if (bcn_ord >= 15)
+		return 0;
+
+	slot = GTS_BASE_SLOT << sf_ord;
+	cap = (GTS_MIN_CAP + slot - 1) / slot;
+
+	return GTS_SLOTS - cap;
+}
+
+static unsigned int gts_cfp_start(void)
+{
+	unsigned int i, start = GTS_SLOTS;
+
+	for (i = 0; i < ngts; i++)
+		if (gts[i].start < start)
+			start = gts[i].start;
+
+	return start;
+}
+
+static int gts_before(const struct gts *a, const struct gts *b)
+{
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	return a->order < b->order;
+}
+
+/* Lays set out anew; fails if it needs too many slots or misses a deadline */
+static int gts_layout(struct gts *set, unsigned int n)
+{
+	unsigned int i, j, slot, total = 0;
+
+	for (i = 0; i < n; i++)
+		total += set[i].len;
+	if (total > gts_cfp_max())
+		return -ENOSPC;
+
+	for (i = 1; i < n; i++) {
+		struct gts g = set[i];
+
+		for (j = i; j > 0 && gts_before(&g, &set[j - 1]); j--)
+			set[j] = set[j - 1];
+		set[j] = g;
+	}
+
+	slot = GTS_SLOTS - total;
+	for (i = 0; i < n; i++) {
+		set[i].start = slot;
+		slot += set[i].len;
+		if (slot > set[i].deadline)
+			return -ETIME;
+	}
+
+	return 0;
+}
+
+static uint8_t gts_char(const struct gts *g, int alloc)
+{
+	return g->len | (g->rx ? IEEE802154_GTS_RX : 0) |
+		(alloc ? IEEE802154_GTS_ALLOC : 0);
+}
+
+/*
+ * Takes set as the new map, telling the MAC about every slot that moved:
+ * first where they were are dropped, so no two descriptors overlap.
+ */
+static void gts_commit(const struct gts *set, unsigned int n)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < ngts; j++)
+			if (gts[j].order == set[i].order)
+				break;
+		if (j < ngts && gts[j].start != set[i].start)
+			coord_gts_notify(gts[j].short_addr, gts_char(&gts[j], 0),
+					gts[j].start, IEEE802154_SUCCESS);
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < ngts; j++)
+			if (gts[j].order == set[i].order)
+				break;
+		if (j < ngts && gts[j].start == set[i].start)
+			continue;
+		coord_gts_notify(set[i].short_addr, gts_char(&set[i], 1),
+				set[i].start, IEEE802154_SUCCESS);
+	}
+
+	memcpy(gts, set, n * sizeof(*set));
+	ngts = n;
+}
+
+static int gts_find(uint16_t short_addr, int rx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ngts; i++)
+		if (gts[i].short_addr == short_addr && gts[i].rx == rx)
+			return i;
+
+	return -1;
+}
+
+static void gts_remove(unsigned int i)
+{
+	struct gts set[GTS_MAX];
+	struct gts g = gts[i];
+	unsigned int n = 0, j;
+
+	for (j = 0; j < ngts; j++)
+		if (j != i)
+			set[n++] = gts[j];
+
+	coord_trace(TRACE_GTS, NULL, g.short_addr, gts_char(&g, 0), g.start);
+	coord_gts_notify(g.short_addr, gts_char(&g, 0), g.start, IEEE802154_SUCCESS);
+
+	/*
+	 * Closing the gap moves the slots before it later, which may
+	 * break a deadline: then the gap stays until the next request.
+	 */
+	if (!gts_layout(set, n)) {
+		gts_commit(set, n);
+		return;
+	}
+
+	for (j = i; j + 1 < ngts; j++)
+		gts[j] = gts[j + 1];
+	ngts--;
+}
+
+/*
+ * A device already holding a GTS in that direction gets the new one
+ * instead, if it fits; otherwise it keeps the old one.
+ */
+static uint8_t gts_alloc(uint16_t short_addr, int rx, unsigned int len,
+		unsigned int deadline)
+{
+	struct gts set[GTS_MAX];
+	unsigned int n = 0, i;
+	int old = gts_find(short_addr, rx);
+
+	if (!len || len > GTS_SLOTS - 1 || deadline > GTS_SLOTS)
+		return IEEE802154_INVALID_PARAMETER;
+
+	for (i = 0; i < ngts; i++)
+		if ((int)i != old)
+			set[n++] = gts[i];
+	if (n == GTS_MAX)
+		return IEEE802154_DENIED;
+
+	set[n].short_addr = short_addr;
+	set[n].rx = rx;
+	set[n].len = len;
+	set[n].deadline = deadline;
+	set[n].order = next_order;
+	n++;
+
+	if (gts_layout(set, n))
+		return IEEE802154_DENIED;
+
+	/* The MAC drops the old descriptor only if told so */
+	if (old >= 0) {
+		const struct gts *g = &gts[old];
+
+		coord_trace(TRACE_GTS, NULL, g->short_addr, gts_char(g, 0), g->start);
+		coord_gts_notify(g->short_addr, gts_char(g, 0), g->start,
+				IEEE802154_SUCCESS);
+	}
+
+	next_order++;
+	gts_commit(set, n);
+
+	return IEEE802154_SUCCESS;
+}
+
+void coord_gts_init(unsigned int bo, unsigned int so)
+{
+	bcn_ord = bo;
+	sf_ord = so;
+	ngts = 0;
+
+	if (gts_cfp_max())
+		log_msg(0, "gts: beacon order %u, superframe order %u, up to %u slots\n",
+				bo, so, gts_cfp_max());
+}
+
+/* MLME-GTS.indication: a request or a release by the device itself */
+void coord_gts_request(uint16_t short_addr, uint8_t characteristics)
+{
+	int rx = !!(characteristics & IEEE802154_GTS_RX);
+	unsigned int len = characteristics & IEEE802154_GTS_LEN;
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	uint8_t status;
+	time_t stamp;
+	int i;
+
+	if (!(characteristics & IEEE802154_GTS_ALLOC)) {
+		i = gts_find(short_addr, rx);
+		if (i >= 0)
+			gts_remove(i);
+		return;
+	}
+
+	if (!gts_cfp_max() || addrdb_get_short(short_addr, hwa, &stamp))
+		status = IEEE802154_DENIED;
+	else
+		status = gts_alloc(short_addr, rx, len, GTS_SLOTS);
+
+	coord_trace(TRACE_GTS, NULL, short_addr, characteristics, status);
+	if (status != IEEE802154_SUCCESS) {
+		coord_count(COORD_CNT_GTS_DENIED);
+		coord_gts_notify(short_addr, characteristics, 0, status);
+	}
+}
+
+/*
+ * Before a handoff: the successor starts with an empty CFP, so the MAC
+ * must not keep descriptors it would not know about.
+ */
+void coord_gts_release_all(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ngts; i++) {
+		const struct gts *g = &gts[i];
+
+		coord_trace(TRACE_GTS, NULL, g->short_addr, gts_char(g, 0), g->start);
+		coord_gts_notify(g->short_addr, gts_char(g, 0), g->start,
+				IEEE802154_SUCCESS);
+	}
+	ngts = 0;
+}
+
+/* The device is gone, and so are its slots */
+void coord_gts_release(uint16_t short_addr)
+{
+	int i;
+
+	while ((i = gts_find(short_addr, 0)) >= 0 ||
+	       (i = gts_find(short_addr, 1)) >= 0)
+		gts_remove(i);
+}
+
+static int parse_dir(const char *arg)
+{
+	if (!strcmp(arg, "tx"))
+		return 0;
+	if (!strcmp(arg, "rx"))
+		return 1;
+	return -1;
+}
+
+static int parse_short(const char *arg, uint16_t *short_addr)
+{
+	char *end;
+	long val = strtol(arg, &end, 16);
+
+	if (*end || end == arg || val < 0 || val > 0xfffd)
+		return -1;
+	*short_addr = val;
+	return 0;
+}
+
+/* "start len short_addr tx|rx deadline" per GTS, in slot order */
+static int gts_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	unsigned int i;
+
+	if (!gts_cfp_max())
+		return coord_ctl_error(c, "not a beacon-enabled PAN");
+
+	coord_ctl_printf(c, "orders %u %u\n", bcn_ord, sf_ord);
+	coord_ctl_printf(c, "cfp %u %u\n", gts_cfp_start(), gts_cfp_max());
+	for (i = 0; i < ngts; i++) {
+		const struct gts *g = &gts[i];
+
+		coord_ctl_printf(c, "%u %u 0x%04x %s %u\n", g->start, g->len,
+				g->short_addr, g->rx ? "rx" : "tx", g->deadline);
+	}
+
+	return 0;
+}
+
+/* Set up by hand, for devices whose latency needs the MAC can't tell us */
+static int gts_add_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	unsigned long len, deadline = GTS_SLOTS;
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	time_t stamp;
+	char *end;
+	int rx;
+
+	if (argc != 4 && argc != 5)
+		return coord_ctl_error(c, "usage: gts-add short_addr slots tx|rx [deadline]");
+
+	if (parse_short(argv[1], &short_addr))
+		return coord_ctl_error(c, "bad short address");
+	len = strtoul(argv[2], &end, 0);
+	if (*end || end == argv[2] || len > GTS_SLOTS)
+		return coord_ctl_error(c, "bad slot count");
+	rx = parse_dir(argv[3]);
+	if (rx < 0)
+		return coord_ctl_error(c, "direction is tx or rx");
+	if (argc == 5) {
+		deadline = strtoul(argv[4], &end, 0);
+		if (*end || end == argv[4] || deadline > GTS_SLOTS)
+			return coord_ctl_error(c, "bad deadline");
+	}
+
+	if (!gts_cfp_max())
+		return coord_ctl_error(c, "not a beacon-enabled PAN");
+	if (addrdb_get_short(short_addr, hwa, &stamp))
+		return coord_ctl_error(c, "no such lease");
+
+	switch (gts_alloc(short_addr, rx, len, deadline)) {
+	case IEEE802154_SUCCESS:
+		break;
+	case IEEE802154_INVALID_PARAMETER:
+		return coord_ctl_error(c, "bad slot count or deadline");
+	default:
+		coord_count(COORD_CNT_GTS_DENIED);
+		return coord_ctl_error(c, "does not fit");
+	}
+
+	return gts_cmd(c, 1, argv);
+}
+
+static int gts_del_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	uint16_t short_addr;
+	int rx, i;
+
+	if (argc != 3)
+		return coord_ctl_error(c, "usage: gts-del short_addr tx|rx");
+
+	if (parse_short(argv[1], &short_addr))
+		return coord_ctl_error(c, "bad short address");
+	rx = parse_dir(argv[2]);
+	if (rx < 0)
+		return coord_ctl_error(c, "direction is tx or rx");
+
+	i = gts_find(short_addr, rx);
+	if (i < 0)
+		return coord_ctl_error(c, "no such GTS");
+	gts_remove(i);
+
+	return gts_cmd(c, 1, argv);
+}
+
+const struct coord_ctl_module coord_gts_ctl = {
+	.name = "gts",
+	.commands = {
+	{
+		.name	= "gts",
+		.usage	= "",
+		.call	= gts_cmd,
+	},
+	{
+		.name	= "gts-add",
+		.usage	= "short_addr slots tx|rx [deadline]",
+		.call	= gts_add_cmd,
+	},
+	{
+		.name	= "gts-del",
+		.usage	= "short_addr tx|rx",
+		.call	= gts_del_cmd,
+	},
+	{}}
+};
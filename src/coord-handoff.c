@@ -0,0 +1,291 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Hot upgrade of izcoordinator: the running instance hands its sockets
+ * and lease table to its successor over the control socket.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <logging.h>
+
+#include "coordinator.h"
+
+#define HANDOFF_MAGIC	"IZHANDO1"
+/* Leases sent or inserted per batch */
+#define HANDOFF_BATCH	256
+
+struct handoff_hdr {
+	char magic[8];
+	int32_t family;
+	uint32_t nleases;
+	char iface[IFNAMSIZ];
+};
+
+struct handoff_lease {
+	uint8_t hwaddr[8];
+	int64_t stamp;
+	uint16_t short_addr;
+	uint16_t pad[3];
+};
+
+struct handoff_batch {
+	int fd;
+	int err;
+	unsigned int n;
+	struct handoff_lease lease[HANDOFF_BATCH];
+};
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t n = recv(fd, p, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n ? -errno : -EPIPE;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void handoff_flush(struct handoff_batch *b)
+{
+	if (!b->err && b->n)
+		b->err = write_full(b->fd, b->lease, b->n * sizeof(b->lease[0]));
+	b->n = 0;
+}
+
+static void handoff_add(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	struct handoff_batch *b = arg;
+	struct handoff_lease *l = &b->lease[b->n++];
+
+	memset(l, 0, sizeof(*l));
+	memcpy(l->hwaddr, hwa, sizeof(l->hwaddr));
+	l->short_addr = short_addr;
+	l->stamp = stamp;
+
+	if (b->n == HANDOFF_BATCH)
+		handoff_flush(b);
+}
+
+static int handoff_send(int fd, struct coord_handoff *h)
+{
+	static struct handoff_batch batch;
+	struct handoff_hdr hdr;
+	int fds[2] = { h->nl_fd, h->ctl_fd };
+	char cbuf[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, HANDOFF_MAGIC, sizeof(hdr.magic));
+	hdr.family = h->family;
+	hdr.nleases = addrdb_lease_count();
+	memcpy(hdr.iface, h->iface, sizeof(hdr.iface));
+
+	memset(cbuf, 0, sizeof(cbuf));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hdr))
+		return errno ? -errno : -EPIPE;
+
+	batch.fd = fd;
+	batch.err = 0;
+	batch.n = 0;
+	addrdb_for_each(handoff_add, &batch);
+	handoff_flush(&batch);
+
+	return batch.err;
+}
+
+static int handoff_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	struct coord_handoff h;
+	uint64_t start = coord_now_ns();
+	int err;
+
+	err = coord_handoff_release(&h);
+	if (err < 0)
+		return coord_ctl_error(c, "this transport can't be handed off");
+
+	err = handoff_send(c->fd, &h);
+	if (err < 0) {
+		log_msg(0, "handoff: %s, still serving\n", strerror(-err));
+		coord_handoff_resume();
+		return coord_ctl_error(c, strerror(-err));
+	}
+
+	log_msg(0, "handoff: %u leases handed over in %llu us\n",
+			addrdb_lease_count(),
+			(unsigned long long)(coord_now_ns() - start) / 1000);
+	coord_handoff_done();
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_handoff_ctl = {
+	.name = "handoff",
+	.commands = {
+	{
+		.name	= "handoff",
+		.usage	= "(used by izcoordinator -H)",
+		.call	= handoff_cmd,
+	},
+	{}}
+};
+
+int coord_handoff_receive(const char *ctl_path, struct coord_handoff *h)
+{
+	static struct handoff_lease lease[HANDOFF_BATCH];
+	struct sockaddr_un addr;
+	struct handoff_hdr hdr;
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+	uint32_t left;
+	ssize_t n;
+	int fd, err;
+
+	if (strlen(ctl_path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, ctl_path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err = -errno;
+		goto out;
+	}
+	err = write_full(fd, "handoff\n", 8);
+	if (err < 0)
+		goto out;
+
+	h->nl_fd = h->ctl_fd = -1;
+
+	do
+		n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		err = n ? -errno : -EPIPE;
+		goto out;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+			int fds[2];
+
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+			h->nl_fd = fds[0];
+			h->ctl_fd = fds[1];
+		}
+
+	if (h->nl_fd < 0) {
+		/* The old instance answered with a text error */
+		((char *)&hdr)[n < (ssize_t)sizeof(hdr) ? n : (ssize_t)sizeof(hdr) - 1] = '\0';
+		log_msg(0, "handoff refused: %s", (char *)&hdr);
+		err = -EPROTO;
+		goto out;
+	}
+
+	err = read_full(fd, (char *)&hdr + n, sizeof(hdr) - n);
+	if (err < 0)
+		goto out_fds;
+	if (memcmp(hdr.magic, HANDOFF_MAGIC, sizeof(hdr.magic))) {
+		err = -EPROTO;
+		goto out_fds;
+	}
+
+	h->family = hdr.family;
+	memcpy(h->iface, hdr.iface, sizeof(h->iface));
+	h->iface[sizeof(h->iface) - 1] = '\0';
+
+	for (left = hdr.nleases; left; ) {
+		unsigned int i, cnt = left < HANDOFF_BATCH ? left : HANDOFF_BATCH;
+
+		err = read_full(fd, lease, cnt * sizeof(lease[0]));
+		if (err < 0)
+			goto out_fds;
+		for (i = 0; i < cnt; i++)
+			addrdb_insert_quiet(lease[i].hwaddr, lease[i].short_addr, lease[i].stamp);
+		left -= cnt;
+	}
+
+	close(fd);
+	return 0;
+
+out_fds:
+	close(h->nl_fd);
+	close(h->ctl_fd);
+out:
+	close(fd);
+	return err;
+}
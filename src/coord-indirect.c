@@ -0,0 +1,401 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Indirect transmission: data for devices that sleep with the receiver
+ * off is held until they poll for it with a data request.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+#define INDIRECT_UNIT_SYMBOLS	960	/* aBaseSuperframeDuration */
+
+/*
+ * All frames come from one pool allocated at start, so a fleet of
+ * sleeping devices can never make us grow. A device is in the tables
+ * only while it has frames queued; both tables point to the same entry,
+ * and a poll finds it by whatever address the device used.
+ */
+struct indirect_frame {
+	struct indirect_frame *next;
+	uint64_t expires_ns;
+	uint8_t len;
+	uint8_t data[INDIRECT_PAYLOAD_MAX];
+};
+
+struct indirect_dev {
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	unsigned int depth;
+	struct indirect_frame *head, **tail;
+	struct coord_timer timer;	/* when head expires */
+};
+
+static struct simple_hash *by_hw, *by_short;
+static struct indirect_frame *pool, *free_frames;
+static unsigned int pool_size, dev_max, queued;
+static uint64_t persistence_ns;
+
+static unsigned int indirect_hash_short(const void *key)
+{
+	return *(const uint16_t *)key;
+}
+
+static int indirect_eq_short(const void *key1, const void *key2)
+{
+	return *(const uint16_t *)key1 != *(const uint16_t *)key2;
+}
+
+static void indirect_arm(struct indirect_dev *d, uint64_t now)
+{
+	uint64_t left = d->head->expires_ns > now ? d->head->expires_ns - now : 0;
+
+	coord_timer_add(&d->timer, left / 1000000 + 1);
+}
+
+static struct indirect_frame *indirect_pop(struct indirect_dev *d)
+{
+	struct indirect_frame *f = d->head;
+
+	d->head = f->next;
+	if (!d->head)
+		d->tail = &d->head;
+	d->depth--;
+	queued--;
+
+	return f;
+}
+
+static void indirect_put(struct indirect_frame *f)
+{
+	f->next = free_frames;
+	free_frames = f;
+}
+
+static void indirect_free(struct indirect_dev *d)
+{
+	coord_timer_del(&d->timer);
+	shash_drop(by_short, &d->short_addr);
+	shash_drop(by_hw, d->hwaddr);
+	free(d);
+}
+
+/* Drops every frame of d, and d with them */
+static void indirect_purge(struct indirect_dev *d, enum coord_counter why)
+{
+	while (d->head) {
+		indirect_put(indirect_pop(d));
+		coord_count(why);
+	}
+	indirect_free(d);
+}
+
+/* Frames are queued in order and live equally long: the head goes first */
+static void indirect_expire(void *arg)
+{
+	struct indirect_dev *d = arg;
+	uint64_t now = coord_now_ns();
+
+	while (d->head && d->head->expires_ns <= now) {
+		indirect_put(indirect_pop(d));
+		coord_count(COORD_CNT_INDIRECT_EXPIRED);
+		coord_trace(TRACE_INDIRECT_EXPIRE, d->hwaddr, d->short_addr, d->depth, 0);
+	}
+
+	if (d->head)
+		indirect_arm(d, now);
+	else
+		indirect_free(d);
+}
+
+/* Symbol time in ns, channel page 0 */
+static unsigned int indirect_symbol_ns(uint8_t channel)
+{
+	if (channel == 0)
+		return 50000;	/* 868 MHz BPSK */
+	if (channel <= 10)
+		return 25000;	/* 915 MHz BPSK */
+	return 16000;		/* 2.4 GHz O-QPSK */
+}
+
+/* "frames[:per_device[:persistence]]", persistence in unit periods */
+int coord_indirect_parse(const char *arg, unsigned int *frames,
+		unsigned int *per_dev, unsigned int *persistence)
+{
+	char *end;
+
+	*frames = strtoul(arg, &end, 0);
+	if (*end == ':')
+		*per_dev = strtoul(end + 1, &end, 0);
+	if (*end == ':')
+		*persistence = strtoul(end + 1, &end, 0);
+	if (*end || end == arg || !*per_dev || !*persistence ||
+	    *persistence > 0xffff)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * macTransactionPersistenceTime counts unit periods of
+ * aBaseSuperframeDuration symbols, times 2^BO on a beacon-enabled PAN.
+ */
+int coord_indirect_init(unsigned int frames, unsigned int per_dev,
+		unsigned int persistence, uint8_t channel, unsigned int bcn_ord)
+{
+	unsigned int i;
+
+	by_hw = shash_new(hw_hash, hw_eq);
+	by_short = shash_new(indirect_hash_short, indirect_eq_short);
+	pool = calloc(frames ? frames : 1, sizeof(*pool));
+	if (!by_hw || !by_short || !pool)
+		return -ENOMEM;
+
+	for (i = frames; i > 0; i--)
+		indirect_put(&pool[i - 1]);
+	pool_size = frames;
+	dev_max = per_dev;
+	persistence_ns = (uint64_t)persistence * INDIRECT_UNIT_SYMBOLS *
+		indirect_symbol_ns(channel) << (bcn_ord < 15 ? bcn_ord : 0);
+
+	if (frames)
+		log_msg(0, "indirect: %u frames, %u per device, kept %llu ms\n",
+				frames, per_dev,
+				(unsigned long long)persistence_ns / 1000000);
+
+	return 0;
+}
+
+/* Takes data for the leased device at short_addr, or at hwa if that is set */
+int coord_indirect_queue(const uint8_t *hwa, uint16_t short_addr,
+		const void *data, size_t len)
+{
+	uint8_t lease_hwa[IEEE802154_ADDR_LEN];
+	struct indirect_dev *d;
+	struct indirect_frame *f;
+	time_t stamp;
+
+	if (len > INDIRECT_PAYLOAD_MAX)
+		return -EMSGSIZE;
+
+	if (hwa) {
+		if (addrdb_get_hw(hwa, &short_addr, &stamp))
+			return -ENOENT;
+	} else {
+		if (addrdb_get_short(short_addr, lease_hwa, &stamp))
+			return -ENOENT;
+		hwa = lease_hwa;
+	}
+
+	d = shash_get(by_hw, hwa);
+	if (!free_frames || (d && d->depth >= dev_max)) {
+		coord_count(COORD_CNT_INDIRECT_OVERFLOW);
+		coord_trace(TRACE_INDIRECT_OVERFLOW, hwa, short_addr, d ? d->depth : 0, 0);
+		return -ENOBUFS;
+	}
+
+	if (!d) {
+		d = calloc(1, sizeof(*d));
+		if (!d)
+			return -ENOMEM;
+		memcpy(d->hwaddr, hwa, IEEE802154_ADDR_LEN);
+		d->short_addr = short_addr;
+		d->tail = &d->head;
+		d->timer.cb = indirect_expire;
+		d->timer.arg = d;
+		shash_insert(by_hw, d->hwaddr, d);
+		shash_insert(by_short, &d->short_addr, d);
+	}
+
+	f = free_frames;
+	free_frames = f->next;
+	f->next = NULL;
+	f->expires_ns = coord_now_ns() + persistence_ns;
+	f->len = len;
+	memcpy(f->data, data, len);
+
+	*d->tail = f;
+	d->tail = &f->next;
+	if (!d->depth++)
+		indirect_arm(d, coord_now_ns());
+	queued++;
+	coord_count(COORD_CNT_INDIRECT_QUEUED);
+
+	return 0;
+}
+
+/* A data request from the device at short_addr, or at hwa if that is set */
+void coord_indirect_poll(const uint8_t *hwa, uint16_t short_addr)
+{
+	struct indirect_dev *d;
+	struct indirect_frame *f;
+	int err;
+
+	d = hwa ? shash_get(by_hw, hwa) : shash_get(by_short, &short_addr);
+	if (!d) {
+		coord_count(COORD_CNT_INDIRECT_NO_DATA);
+		return;
+	}
+
+	/* On failure the frame stays first in line, for the next poll */
+	f = d->head;
+	err = coord_indirect_send(d->short_addr, f->data, f->len);
+	coord_trace(TRACE_INDIRECT_SEND, d->hwaddr, d->short_addr, d->depth - 1, err);
+	if (err < 0) {
+		log_msg(0, "indirect: can't send to 0x%04x: %s\n",
+				d->short_addr, strerror(-err));
+		return;
+	}
+
+	indirect_put(indirect_pop(d));
+	coord_count(COORD_CNT_INDIRECT_SENT);
+	if (!d->head)
+		indirect_free(d);
+}
+
+/* Data waits for a device, not for an address it no longer has */
+void coord_indirect_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr)
+{
+	struct indirect_dev *d;
+
+	if (!by_hw || !(d = shash_get(by_hw, hwa)))
+		return;
+
+	if (ev == ADDRDB_LEASE_DEL) {
+		coord_trace(TRACE_INDIRECT_EXPIRE, d->hwaddr, d->short_addr, d->depth, 1);
+		indirect_purge(d, COORD_CNT_INDIRECT_PURGED);
+	} else if (d->short_addr != short_addr) {
+		shash_drop(by_short, &d->short_addr);
+		d->short_addr = short_addr;
+		shash_insert(by_short, &d->short_addr, d);
+	}
+}
+
+void coord_indirect_stats(unsigned int *frames, unsigned int *devices,
+		unsigned int *capacity)
+{
+	*frames = queued;
+	*devices = by_hw ? shash_count(by_hw) : 0;
+	*capacity = pool_size;
+}
+
+static void indirect_print(const void *key, void *data, void *arg)
+{
+	const struct indirect_dev *d = data;
+	const uint8_t *hwa = d->hwaddr;
+	uint64_t now = coord_now_ns();
+
+	coord_ctl_printf(arg, "%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x 0x%04x %u %llu\n",
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7],
+			d->short_addr, d->depth,
+			d->head->expires_ns > now ?
+			(unsigned long long)(d->head->expires_ns - now) / 1000000 : 0);
+}
+
+/* "hwaddr short_addr frames ms_to_expiry" per device with data waiting */
+static int indirect_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	coord_ctl_printf(c, "queued %u of %u\n", queued, pool_size);
+	shash_for_each(by_hw, indirect_print, c);
+
+	return 0;
+}
+
+/* For the application side of a gateway: payload given in hex */
+static int indirect_queue_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN], data[INDIRECT_PAYLOAD_MAX];
+	uint16_t short_addr = 0;
+	size_t len, i;
+	unsigned int b;
+	char *end;
+	long val;
+	int n;
+
+	if (argc != 3)
+		return coord_ctl_error(c, "usage: indirect-queue hwaddr|short_addr hex");
+
+	if (strchr(argv[1], ':')) {
+		n = parse_hwaddr(argv[1], hwa);
+		if (n < 0 || argv[1][n])
+			return coord_ctl_error(c, "bad hardware address");
+	} else {
+		val = strtol(argv[1], &end, 16);
+		if (*end || end == argv[1] || val < 0 || val > 0xfffd)
+			return coord_ctl_error(c, "bad short address");
+		short_addr = val;
+	}
+
+	len = strlen(argv[2]);
+	if (len % 2)
+		return coord_ctl_error(c, "bad payload");
+	len /= 2;
+	if (len > sizeof(data))
+		return coord_ctl_error(c, "payload too long");
+	for (i = 0; i < len; i++) {
+		if (!isxdigit(argv[2][2 * i]) || !isxdigit(argv[2][2 * i + 1]) ||
+		    sscanf(argv[2] + 2 * i, "%2x", &b) != 1)
+			return coord_ctl_error(c, "bad payload");
+		data[i] = b;
+	}
+
+	switch (coord_indirect_queue(strchr(argv[1], ':') ? hwa : NULL,
+				short_addr, data, len)) {
+	case 0:
+		break;
+	case -ENOENT:
+		return coord_ctl_error(c, "no such lease");
+	case -ENOBUFS:
+		return coord_ctl_error(c, "queue full");
+	default:
+		return coord_ctl_error(c, "out of memory");
+	}
+
+	coord_ctl_printf(c, "queued %u of %u\n", queued, pool_size);
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_indirect_ctl = {
+	.name = "indirect",
+	.commands = {
+	{
+		.name	= "indirect",
+		.usage	= "",
+		.call	= indirect_cmd,
+	},
+	{
+		.name	= "indirect-queue",
+		.usage	= "hwaddr|short_addr hex",
+		.call	= indirect_queue_cmd,
+	},
+	{}}
+};
@@ -0,0 +1,167 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Lease queries on the izcoordinator control socket, answered from
+ * the in-memory tables instead of the lease file.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <addrdb.h>
+
+#include "coordinator.h"
+
+/* Leases formatted per refill of the output buffer while dumping */
+#define LEASES_CHUNK	64
+
+/* Answer lines are "hwaddr short_addr timestamp", hwaddr as in the lease file */
+static void lease_print(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	coord_ctl_printf(arg, "%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x 0x%04x %ld\n",
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7],
+			short_addr, (long)stamp);
+}
+
+static int lease_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	time_t stamp;
+	char *end;
+	long val;
+	int n;
+
+	if (argc != 2)
+		return coord_ctl_error(c, "usage: lease hwaddr|short_addr");
+
+	if (strchr(argv[1], ':')) {
+		n = parse_hwaddr(argv[1], hwa);
+		if (n < 0 || argv[1][n])
+			return coord_ctl_error(c, "bad hardware address");
+		if (addrdb_get_hw(hwa, &short_addr, &stamp))
+			return coord_ctl_error(c, "no such lease");
+	} else {
+		val = strtol(argv[1], &end, 16);
+		if (*end || end == argv[1] || val < 0 || val > 0xffff)
+			return coord_ctl_error(c, "bad short address");
+		short_addr = val;
+		if (addrdb_get_short(short_addr, hwa, &stamp))
+			return coord_ctl_error(c, "no such lease");
+	}
+
+	lease_print(hwa, short_addr, stamp, c);
+
+	return 0;
+}
+
+/* "first last router_short router_hwaddr" of the block holding short_addr */
+static int block_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	uint16_t router, first, last;
+	time_t stamp;
+	char *end;
+	long val;
+
+	if (argc != 2)
+		return coord_ctl_error(c, "usage: block short_addr");
+
+	val = strtol(argv[1], &end, 16);
+	if (*end || end == argv[1] || val < 0 || val > 0xffff)
+		return coord_ctl_error(c, "bad short address");
+
+	if (addrdb_block_owner(val, &router) ||
+	    addrdb_get_block(router, &first, &last) ||
+	    addrdb_get_short(router, hwa, &stamp))
+		return coord_ctl_error(c, "not in a delegated block");
+
+	coord_ctl_printf(c, "0x%04x 0x%04x 0x%04x %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n",
+			first, last, router,
+			hwa[0], hwa[1], hwa[2], hwa[3],
+			hwa[4], hwa[5], hwa[6], hwa[7]);
+
+	return 0;
+}
+
+/*
+ * The dump goes on from the next short address on every refill, so
+ * leases added or dropped meanwhile are seen or not, but the walk
+ * itself stays valid.
+ */
+static int leases_more(struct coord_ctl_client *c)
+{
+	unsigned int next = (uintptr_t)c->priv;
+
+	next = addrdb_walk(next, LEASES_CHUNK, lease_print, c);
+	c->priv = (void *)(uintptr_t)next;
+
+	return next < 0x10000;
+}
+
+static int leases_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	c->priv = (void *)(uintptr_t)0;
+	c->more = leases_more;
+
+	return 0;
+}
+
+static int count_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	coord_ctl_printf(c, "leases %u\n", addrdb_lease_count());
+	coord_ctl_printf(c, "pool %u\n", addrdb_pool_size());
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_leases_ctl = {
+	.name = "leases",
+	.commands = {
+	{
+		.name	= "lease",
+		.usage	= "hwaddr|short_addr",
+		.call	= lease_cmd,
+		.remote	= 1,
+	},
+	{
+		.name	= "block",
+		.usage	= "short_addr",
+		.call	= block_cmd,
+		.remote	= 1,
+	},
+	{
+		.name	= "leases",
+		.usage	= "",
+		.call	= leases_cmd,
+		.remote	= 1,
+	},
+	{
+		.name	= "count",
+		.usage	= "",
+		.call	= count_cmd,
+		.remote	= 1,
+	},
+	{}}
+};
@@ -0,0 +1,175 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Follow the managed interface through rtnetlink link notifications,
+ * so the PAN is started again when the interface comes back up.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <logging.h>
+
+#include "coordinator.h"
+
+/*
+ * The interface is matched by name: a re-plugged device, or one
+ * attached again by izattach, comes back with a new index.
+ */
+enum link_state {
+	LINK_DOWN,
+	LINK_UP,	/* PAN started */
+};
+
+static enum link_state state;
+static const char *link_name;
+static int link_fd = -1;
+
+static void link_event(const struct ifinfomsg *ifi, const char *name, int gone)
+{
+	int up = !gone && (ifi->ifi_flags & IFF_UP);
+
+	if (strcmp(name, link_name))
+		return;
+
+	if (state == LINK_UP && !up) {
+		state = LINK_DOWN;
+		coord_trace(TRACE_LINK, NULL, 0, 0, ifi->ifi_index);
+		log_msg(0, "%s is %s, PAN stopped\n", name, gone ? "gone" : "down");
+	} else if (state == LINK_DOWN && up) {
+		state = LINK_UP;
+		coord_trace(TRACE_LINK, NULL, 0, 1, ifi->ifi_index);
+		log_msg(0, "%s is up again, restarting PAN\n", name);
+		coord_count(COORD_CNT_PAN_RESTART);
+		coord_link_up();
+	}
+}
+
+/* Ask for the current state; the answer goes through link_cb() */
+static void link_query(void)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+		struct rtattr rta;
+		char name[IFNAMSIZ];
+	} req;
+	size_t len = strlen(link_name) + 1;
+
+	if (link_fd < 0 || len > IFNAMSIZ)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.rta.rta_type = IFLA_IFNAME;
+	req.rta.rta_len = RTA_LENGTH(len);
+	memcpy(req.name, link_name, len);
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi)) + RTA_ALIGN(req.rta.rta_len);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	if (send(link_fd, &req, req.nlh.nlmsg_len, 0) < 0)
+		log_msg(0, "link: can't ask for %s: %s\n", link_name, strerror(errno));
+}
+
+static void link_cb(int fd, short revents, void *arg)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	ssize_t n;
+
+	while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n);
+		     nlh = NLMSG_NEXT(nlh, n)) {
+			struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+			struct rtattr *rta;
+			const char *name = NULL;
+			int len;
+
+			/* Our query for an interface that is not there (yet) */
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+				if (e->error == -ENODEV && state == LINK_UP) {
+					state = LINK_DOWN;
+					log_msg(0, "%s is gone, PAN stopped\n", link_name);
+				}
+				continue;
+			}
+			if (nlh->nlmsg_type != RTM_NEWLINK &&
+			    nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+
+			len = IFLA_PAYLOAD(nlh);
+			for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+				if (rta->rta_type == IFLA_IFNAME)
+					name = RTA_DATA(rta);
+			if (name)
+				link_event(ifi, name, nlh->nlmsg_type == RTM_DELLINK);
+		}
+	}
+
+	/* The kernel dropped notifications: we may have missed a change */
+	if (n < 0 && errno == ENOBUFS) {
+		log_msg(0, "link: notifications lost, asking for %s\n", link_name);
+		link_query();
+	}
+}
+
+/*
+ * The PAN on iface is started already; from now on a START is sent
+ * whenever iface goes from down to up.
+ */
+int coord_link_init(const char *iface)
+{
+	struct sockaddr_nl sa;
+	int err;
+
+	link_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (link_fd < 0)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK;
+	if (bind(link_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err = -errno;
+		close(link_fd);
+		link_fd = -1;
+		return err;
+	}
+
+	link_name = iface;
+	state = LINK_UP;
+
+	err = coord_loop_add(link_fd, POLLIN, link_cb, NULL);
+	if (err < 0)
+		return err;
+
+	/* It may have gone down before we listened */
+	link_query();
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Main event loop of izcoordinator.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+
+#include <logging.h>
+
+#include "coordinator.h"
+
+/*
+ * Timers hang off a hashed wheel of LOOP_WHEEL_SIZE slots, LOOP_TICK_MS
+ * apart, so arming and cancelling is O(1) however many are pending.
+ * A timer due more than one turn ahead just stays in its slot until
+ * the wheel comes round to it again.
+ */
+#define LOOP_WHEEL_SIZE	256	/* power of two */
+#define LOOP_TICK_MS	10
+
+struct loop_handler {
+	coord_fd_cb cb;
+	void *arg;
+};
+
+static struct pollfd *pfds;
+static struct loop_handler *handlers;
+static int nfds, maxfds;
+
+static struct coord_timer *wheel[LOOP_WHEEL_SIZE];
+static unsigned int timers_armed;
+/* Next tick whose slot has not been run yet */
+static uint64_t wheel_tick;
+
+static uint64_t loop_tick(void)
+{
+	return coord_now_ns() / (LOOP_TICK_MS * 1000000ULL);
+}
+
+void coord_timer_add(struct coord_timer *t, unsigned int ms)
+{
+	struct coord_timer **slot;
+	uint64_t now = loop_tick();
+
+	coord_timer_del(t);
+	if (!timers_armed)
+		wheel_tick = now;
+
+	/* At least one tick, so a timer re-armed from its callback waits */
+	t->expires = now + ms / LOOP_TICK_MS + 1;
+	slot = &wheel[t->expires & (LOOP_WHEEL_SIZE - 1)];
+	t->next = *slot;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+	timers_armed++;
+}
+
+void coord_timer_del(struct coord_timer *t)
+{
+	if (!t->pprev)
+		return;
+
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = NULL;
+	timers_armed--;
+}
+
+static void loop_run_timers(void)
+{
+	uint64_t now = loop_tick();
+	struct coord_timer *t;
+
+	for (; timers_armed && wheel_tick <= now; wheel_tick++) {
+		/* Rescan after every callback, it may have touched the slot */
+		t = wheel[wheel_tick & (LOOP_WHEEL_SIZE - 1)];
+		while (t) {
+			if (t->expires > wheel_tick) {
+				t = t->next;
+				continue;
+			}
+			coord_timer_del(t);
+			t->cb(t->arg);
+			t = wheel[wheel_tick & (LOOP_WHEEL_SIZE - 1)];
+		}
+	}
+}
+
+/* Until the next slot with anything in it, NULL if nothing is armed */
+static struct timespec *loop_timeout(struct timespec *ts)
+{
+	uint64_t tick, ns, now;
+	unsigned int i;
+
+	if (!timers_armed)
+		return NULL;
+
+	for (i = 0; i < LOOP_WHEEL_SIZE; i++)
+		if (wheel[(wheel_tick + i) & (LOOP_WHEEL_SIZE - 1)])
+			break;
+	tick = wheel_tick + i;
+
+	ns = tick * LOOP_TICK_MS * 1000000ULL;
+	now = coord_now_ns();
+	ns = ns > now ? ns - now : 0;
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+
+	return ts;
+}
+
+static int loop_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < nfds; i++)
+		if (pfds[i].fd == fd)
+			return i;
+
+	return -1;
+}
+
+int coord_loop_add(int fd, short events, coord_fd_cb cb, void *arg)
+{
+	if (nfds == maxfds) {
+		int n = maxfds ? maxfds * 2 : 16;
+		struct pollfd *np = realloc(pfds, n * sizeof(*np));
+		struct loop_handler *nh;
+
+		if (!np)
+			return -ENOMEM;
+		pfds = np;
+		nh = realloc(handlers, n * sizeof(*nh));
+		if (!nh)
+			return -ENOMEM;
+		handlers = nh;
+		maxfds = n;
+	}
+
+	pfds[nfds].fd = fd;
+	pfds[nfds].events = events;
+	pfds[nfds].revents = 0;
+	handlers[nfds].cb = cb;
+	handlers[nfds].arg = arg;
+	nfds++;
+
+	return 0;
+}
+
+void coord_loop_set_events(int fd, short events)
+{
+	int i = loop_find(fd);
+
+	if (i >= 0)
+		pfds[i].events = events;
+}
+
+/* Safe to call from a callback; the slot is reclaimed after dispatch */
+void coord_loop_del(int fd)
+{
+	int i = loop_find(fd);
+
+	if (i >= 0) {
+		pfds[i].fd = -1;
+		pfds[i].revents = 0;
+	}
+}
+
+static void loop_compact(void)
+{
+	int i, j;
+
+	for (i = j = 0; i < nfds; i++) {
+		if (pfds[i].fd < 0)
+			continue;
+		pfds[j] = pfds[i];
+		handlers[j] = handlers[i];
+		j++;
+	}
+	nfds = j;
+}
+
+/*
+ * Runs until *stop gets set. SIGINT and SIGTERM are only unblocked
+ * while we sleep in ppoll(), so a termination request can never be
+ * lost between the check and the wait.
+ */
+int coord_loop_run(volatile sig_atomic_t *stop)
+{
+	sigset_t block, orig;
+	int i, n, ret = 0;
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigprocmask(SIG_BLOCK, &block, &orig);
+
+	while (!*stop) {
+		struct timespec ts;
+
+		n = ppoll(pfds, nfds, loop_timeout(&ts), &orig);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			log_msg(0, "poll: %s\n", strerror(errno));
+			ret = -errno;
+			break;
+		}
+
+		for (i = 0; i < nfds && n > 0; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents)
+				continue;
+			n--;
+			handlers[i].cb(pfds[i].fd, pfds[i].revents, handlers[i].arg);
+		}
+
+		loop_compact();
+		loop_run_timers();
+	}
+
+	sigprocmask(SIG_SETMASK, &orig, NULL);
+
+	return ret;
+}
@@ -0,0 +1,209 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * izcoordinator metrics, exported in Prometheus text format.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/* Width of the window the per-second rates are averaged over */
+#define RATE_WINDOW	10
+
+struct coord_metrics coord_metrics;
+
+static const struct {
+	const char *name;
+	const char *help;
+} counter_desc[__COORD_CNT_MAX] = {
+	[COORD_CNT_ASSOC] = { "associations_total",
+		"ASSOCIATE_INDIC messages handled" },
+	[COORD_CNT_DISASSOC] = { "disassociations_total",
+		"DISASSOCIATE_INDIC messages handled" },
+	[COORD_CNT_ALLOC_FAIL] = { "allocation_failures_total",
+		"Associations answered with short address 0xffff" },
+	[COORD_CNT_NL_ERROR] = { "netlink_errors_total",
+		"Failed netlink sends and receives" },
+	[COORD_CNT_SEQ_MISMATCH] = { "netlink_seq_mismatch_total",
+		"Netlink replies with an unexpected sequence number" },
+	[COORD_CNT_RATELIMIT_DEV] = { "ratelimit_device_drops_total",
+		"Association requests dropped by the per-device limit" },
+	[COORD_CNT_RATELIMIT_GLOBAL] = { "ratelimit_global_drops_total",
+		"Association requests dropped by the global limit" },
+	[COORD_CNT_ORPHAN] = { "orphan_notifications_total",
+		"ORPHAN_INDIC messages handled" },
+	[COORD_CNT_ORPHAN_UNKNOWN] = { "orphan_unknown_total",
+		"Orphan notifications from devices without a lease" },
+	[COORD_CNT_DEADLINE_MISS] = { "association_deadline_misses_total",
+		"Associations answered later than the -w budget" },
+	[COORD_CNT_FEED_OVERRUN] = { "feed_overruns_total",
+		"Feed subscribers that fell behind and got a new snapshot" },
+	[COORD_CNT_ASSOC_ROLLBACK] = { "association_rollbacks_total",
+		"Leases released because the device did not get the response" },
+	[COORD_CNT_ASSOC_TIMEOUT] = { "association_timeouts_total",
+		"Leases kept although no COMM_STATUS came in time" },
+	[COORD_CNT_ASSOC_DUP] = { "association_duplicates_total",
+		"Retried association requests dropped while a response was in flight" },
+	[COORD_CNT_ACL_DENIED] = { "acl_denied_total",
+		"Associations and orphans refused by the admission lists" },
+	[COORD_CNT_PAN_RESTART] = { "pan_restarts_total",
+		"PAN started again after the interface came back up" },
+	[COORD_CNT_GTS_DENIED] = { "gts_denied_total",
+		"GTS requests that did not fit into the contention-free period" },
+	[COORD_CNT_INDIRECT_QUEUED] = { "indirect_queued_total",
+		"Frames queued for devices that poll" },
+	[COORD_CNT_INDIRECT_SENT] = { "indirect_sent_total",
+		"Queued frames sent to a polling device" },
+	[COORD_CNT_INDIRECT_NO_DATA] = { "indirect_polls_empty_total",
+		"Data requests with nothing queued for the device" },
+	[COORD_CNT_INDIRECT_OVERFLOW] = { "indirect_overflow_drops_total",
+		"Frames refused because the device's queue or the pool was full" },
+	[COORD_CNT_INDIRECT_EXPIRED] = { "indirect_expired_drops_total",
+		"Frames dropped after macTransactionPersistenceTime" },
+	[COORD_CNT_INDIRECT_PURGED] = { "indirect_purged_drops_total",
+		"Frames dropped because the device's lease went away" },
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+} hist_desc[__COORD_HIST_MAX] = {
+	[COORD_HIST_ASSOC_LATENCY] = { "association_latency_seconds",
+		"Time from ASSOCIATE_INDIC receive to ASSOCIATE_RESP send" },
+	[COORD_HIST_FLUSH] = { "lease_flush_seconds",
+		"Time to rewrite the lease file" },
+};
+
+static double metrics_rate(enum coord_counter c, uint64_t now_ns)
+{
+	const struct coord_rate *r = &coord_metrics.rate[c];
+	uint32_t now = now_ns / 1000000000ULL;
+	uint32_t total = 0;
+	int i;
+
+	/* Only complete seconds count, the current one is still filling */
+	for (i = 0; i < COORD_RATE_SLOTS; i++) {
+		uint32_t sec = __atomic_load_n(&r->sec[i], __ATOMIC_RELAXED);
+
+		if (sec < now && now - sec <= RATE_WINDOW)
+			total += __atomic_load_n(&r->count[i], __ATOMIC_RELAXED);
+	}
+
+	return (double)total / RATE_WINDOW;
+}
+
+static void metrics_hist(struct coord_ctl_client *c, enum coord_hist h)
+{
+	const struct coord_hist_data *d = &coord_metrics.hist[h];
+	const char *name = hist_desc[h].name;
+	uint64_t cum = 0;
+	int i;
+
+	coord_ctl_printf(c, "# HELP izcoordinator_%s %s\n", name, hist_desc[h].help);
+	coord_ctl_printf(c, "# TYPE izcoordinator_%s histogram\n", name);
+
+	for (i = 0; i < COORD_HIST_BUCKETS - 1; i++) {
+		cum += __atomic_load_n(&d->bucket[i], __ATOMIC_RELAXED);
+		coord_ctl_printf(c, "izcoordinator_%s_bucket{le=\"%g\"} %llu\n",
+				name, (double)(1ULL << i) / 1e6,
+				(unsigned long long)cum);
+	}
+	cum += __atomic_load_n(&d->bucket[i], __ATOMIC_RELAXED);
+	coord_ctl_printf(c, "izcoordinator_%s_bucket{le=\"+Inf\"} %llu\n",
+			name, (unsigned long long)cum);
+	coord_ctl_printf(c, "izcoordinator_%s_sum %.9f\n", name,
+			__atomic_load_n(&d->sum_ns, __ATOMIC_RELAXED) / 1e9);
+	coord_ctl_printf(c, "izcoordinator_%s_count %llu\n", name,
+			(unsigned long long)__atomic_load_n(&d->count, __ATOMIC_RELAXED));
+	coord_ctl_printf(c, "# HELP izcoordinator_%s_max Worst case since start\n", name);
+	coord_ctl_printf(c, "# TYPE izcoordinator_%s_max gauge\n", name);
+	coord_ctl_printf(c, "izcoordinator_%s_max %.9f\n", name,
+			__atomic_load_n(&d->max_ns, __ATOMIC_RELAXED) / 1e9);
+}
+
+static int metrics_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	uint64_t now = coord_now_ns();
+	unsigned int frames, devices, capacity;
+	int i;
+
+	for (i = 0; i < __COORD_CNT_MAX; i++) {
+		coord_ctl_printf(c, "# HELP izcoordinator_%s %s\n",
+				counter_desc[i].name, counter_desc[i].help);
+		coord_ctl_printf(c, "# TYPE izcoordinator_%s counter\n",
+				counter_desc[i].name);
+		coord_ctl_printf(c, "izcoordinator_%s %llu\n", counter_desc[i].name,
+				(unsigned long long)__atomic_load_n(
+					&coord_metrics.counter[i], __ATOMIC_RELAXED));
+	}
+
+	coord_ctl_printf(c, "# HELP izcoordinator_associations_per_second "
+			"Associations per second over the last %d seconds\n", RATE_WINDOW);
+	coord_ctl_printf(c, "# TYPE izcoordinator_associations_per_second gauge\n");
+	coord_ctl_printf(c, "izcoordinator_associations_per_second %g\n",
+			metrics_rate(COORD_CNT_ASSOC, now));
+	coord_ctl_printf(c, "# HELP izcoordinator_disassociations_per_second "
+			"Disassociations per second over the last %d seconds\n", RATE_WINDOW);
+	coord_ctl_printf(c, "# TYPE izcoordinator_disassociations_per_second gauge\n");
+	coord_ctl_printf(c, "izcoordinator_disassociations_per_second %g\n",
+			metrics_rate(COORD_CNT_DISASSOC, now));
+
+	coord_ctl_printf(c, "# HELP izcoordinator_log_dropped_total Log messages lost to a full queue\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_log_dropped_total counter\n");
+	coord_ctl_printf(c, "izcoordinator_log_dropped_total %lu\n", log_dropped());
+
+	coord_ctl_printf(c, "# HELP izcoordinator_leases Allocated short addresses\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_leases gauge\n");
+	coord_ctl_printf(c, "izcoordinator_leases %u\n", addrdb_lease_count());
+	coord_ctl_printf(c, "# HELP izcoordinator_pool_size Short addresses in the allocation range\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_pool_size gauge\n");
+	coord_ctl_printf(c, "izcoordinator_pool_size %u\n", addrdb_pool_size());
+
+	coord_indirect_stats(&frames, &devices, &capacity);
+	coord_ctl_printf(c, "# HELP izcoordinator_indirect_frames Frames waiting for a poll\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_indirect_frames gauge\n");
+	coord_ctl_printf(c, "izcoordinator_indirect_frames %u\n", frames);
+	coord_ctl_printf(c, "# HELP izcoordinator_indirect_devices Devices with frames waiting\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_indirect_devices gauge\n");
+	coord_ctl_printf(c, "izcoordinator_indirect_devices %u\n", devices);
+	coord_ctl_printf(c, "# HELP izcoordinator_indirect_capacity Frames the pool holds\n");
+	coord_ctl_printf(c, "# TYPE izcoordinator_indirect_capacity gauge\n");
+	coord_ctl_printf(c, "izcoordinator_indirect_capacity %u\n", capacity);
+
+	for (i = 0; i < __COORD_HIST_MAX; i++)
+		metrics_hist(c, i);
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_metrics_ctl = {
+	.name = "metrics",
+	.commands = {
+	{
+		.name	= "metrics",
+		.usage	= "",
+		.call	= metrics_cmd,
+	},
+	{}}
+};
@@ -0,0 +1,610 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Mock izcoordinator transport: a generator thread plays the kernel on
+ * the other end of a socketpair and floods the coordinator with
+ * association requests, so it can be benchmarked without any hardware.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+
+#include <ieee802154.h>
+#include <nl802154.h>
+#include <libcommon.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/* Any id will do, nothing but the generator looks at it */
+#define MOCK_FAMILY	0x20
+#define MOCK_HWADDR	0xfeed000000000000ULL
+/* Messages taken off the socket per loop wakeup */
+#define MOCK_BATCH	64
+/* Give up on outstanding answers after this long */
+#define MOCK_LINGER_NS	1000000000ULL
+
+enum mock_dev_state {
+	DEV_IDLE,
+	DEV_PENDING,
+	DEV_ASSOCIATED,
+};
+
+struct mock_dev {
+	uint64_t sent_ns;
+	uint8_t state;
+	uint16_t short_addr;
+	uint8_t gts_start, gts_len;	/* gts_len 0: none */
+};
+
+static int sv[2] = { -1, -1 };	/* coordinator side, generator side */
+static pthread_t gen;
+static int gen_running;
+static int gen_stop;
+
+static unsigned int rate, count, ndev, loss, ngts, poll_ms;
+/* Data requests sent; frames the coordinator sent, counted on its thread */
+static unsigned int polls, frames_rx;
+/* GTS requests sent and not answered yet, granted and denied ones */
+static unsigned int gts_waiting, gts_granted, gts_denied;
+static struct mock_dev *devs;
+static uint64_t *latency;
+static char dev_name[IFNAMSIZ];
+
+static int mock_sendmsg(struct nl_msg *msg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+
+	if (send(sv[1], nlh, nlh->nlmsg_len, MSG_DONTWAIT) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static struct nl_msg *mock_msg(uint8_t cmd)
+{
+	struct nl_msg *msg = nlmsg_alloc();
+
+	if (!msg)
+		return NULL;
+
+	genlmsg_put(msg, 0, 0, MOCK_FAMILY, 0, 0, cmd, 1);
+	nla_put_string(msg, IEEE802154_ATTR_DEV_NAME, dev_name);
+	nla_put_u32(msg, IEEE802154_ATTR_DEV_INDEX, 1);
+
+	return msg;
+}
+
+static int mock_indic(uint8_t cmd, unsigned int dev)
+{
+	struct nl_msg *msg = mock_msg(cmd);
+	int err;
+
+	if (!msg)
+		return -ENOMEM;
+
+	nla_put_u64(msg, IEEE802154_ATTR_SRC_HW_ADDR, MOCK_HWADDR | dev);
+	if (cmd == IEEE802154_ASSOCIATE_INDIC)
+		/*
+		 * Every 8th device is an FFD, to fill router blocks in tree
+		 * mode; odd ones sleep with the receiver off.
+		 */
+		nla_put_u8(msg, IEEE802154_ATTR_CAPABILITY,
+				1 << 7 | (dev % 2 ? 0 : 1 << 3) | (dev % 8 ? 0 : 1 << 1));
+	else
+		nla_put_u8(msg, IEEE802154_ATTR_REASON, 2);
+
+	err = mock_sendmsg(msg);
+	nlmsg_free(msg);
+
+	return err;
+}
+
+/* Waits for START_REQ and confirms it, learning the interface name */
+static int mock_start(void)
+{
+	struct nlattr *attrs[IEEE802154_ATTR_MAX + 1];
+	struct nlmsghdr *nlh;
+	struct nl_msg *msg;
+	char buf[4096];
+	ssize_t len;
+	int err;
+
+	while (1) {
+		len = recv(sv[1], buf, sizeof(buf), 0);
+		if (len <= 0)
+			return len ? -errno : -EPIPE;
+
+		nlh = (struct nlmsghdr *)buf;
+		if (!nlmsg_ok(nlh, len) ||
+		    ((struct genlmsghdr *)nlmsg_data(nlh))->cmd != IEEE802154_START_REQ)
+			continue;
+		if (genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy) ||
+		    !attrs[IEEE802154_ATTR_DEV_NAME])
+			continue;
+		break;
+	}
+
+	nla_strlcpy(dev_name, attrs[IEEE802154_ATTR_DEV_NAME], sizeof(dev_name));
+
+	msg = mock_msg(IEEE802154_START_CONF);
+	if (!msg)
+		return -ENOMEM;
+	nla_put_u8(msg, IEEE802154_ATTR_STATUS, 0);
+	err = mock_sendmsg(msg);
+	nlmsg_free(msg);
+
+	return err;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(unsigned int n, unsigned int per_mille)
+{
+	if (!n)
+		return 0;
+
+	return latency[(uint64_t)(n - 1) * per_mille / 1000] / 1e3;
+}
+
+static void mock_report(unsigned int sent, unsigned int answered,
+		unsigned int refused, uint64_t first_ns, uint64_t last_ns)
+{
+	double secs = (last_ns - first_ns) / 1e9;
+
+	qsort(latency, answered, sizeof(*latency), cmp_u64);
+
+	log_msg(0, "mock: %u sent, %u answered, %u refused, %u unanswered\n",
+			sent, answered, refused, sent - answered);
+	log_msg(0, "mock: %.0f associations/s over %.3f s\n",
+			secs > 0 ? answered / secs : 0, secs);
+	log_msg(0, "mock: latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+			percentile_us(answered, 500), percentile_us(answered, 990),
+			percentile_us(answered, 999));
+}
+
+/*
+ * What the MAC reports after an ASSOCIATE_RESP. Of the lost ones, half
+ * are reported as not acknowledged and half never get a COMM_STATUS.
+ */
+static void mock_comm_status(uint64_t hwaddr, unsigned int n)
+{
+	struct nl_msg *msg;
+	int lost = loss && n % 100 < loss;
+
+	if (lost && n % 2)
+		return;
+
+	msg = mock_msg(IEEE802154_COMM_STATUS_INDIC);
+	if (!msg)
+		return;
+	nla_put_u64(msg, IEEE802154_ATTR_DEST_HW_ADDR, hwaddr);
+	nla_put_u8(msg, IEEE802154_ATTR_STATUS, lost ? 0xe9 : 0); /* NO_ACK */
+	mock_sendmsg(msg);
+	nlmsg_free(msg);
+}
+
+/* The first ngts devices ask for 1 to 3 slots as soon as they are in */
+static void mock_gts_indic(unsigned int dev)
+{
+	struct nl_msg *msg;
+
+	if (dev >= ngts)
+		return;
+
+	msg = mock_msg(IEEE802154_GTS_INDIC);
+	if (!msg)
+		return;
+	nla_put_u16(msg, IEEE802154_ATTR_SRC_SHORT_ADDR, devs[dev].short_addr);
+	nla_put_u8(msg, IEEE802154_ATTR_CAPABILITY, IEEE802154_GTS_ALLOC |
+			(dev % 2 ? IEEE802154_GTS_RX : 0) | (1 + dev % 3));
+	if (!mock_sendmsg(msg))
+		gts_waiting++;
+	nlmsg_free(msg);
+}
+
+static void mock_gts_conf(struct nlattr **attrs)
+{
+	uint16_t short_addr;
+	uint8_t gts_char;
+	unsigned int i;
+
+	if (!attrs[IEEE802154_ATTR_DEST_SHORT_ADDR] ||
+	    !attrs[IEEE802154_ATTR_CAPABILITY] ||
+	    !attrs[IEEE802154_ATTR_DURATION] ||
+	    !attrs[IEEE802154_ATTR_STATUS])
+		return;
+
+	short_addr = nla_get_u16(attrs[IEEE802154_ATTR_DEST_SHORT_ADDR]);
+	gts_char = nla_get_u8(attrs[IEEE802154_ATTR_CAPABILITY]);
+
+	for (i = 0; i < ngts && i < ndev; i++)
+		if (devs[i].state == DEV_ASSOCIATED && devs[i].short_addr == short_addr)
+			break;
+	if (i == ngts || i == ndev)
+		return;
+
+	if (!(gts_char & IEEE802154_GTS_ALLOC)) {
+		devs[i].gts_len = 0;
+		return;
+	}
+
+	/* Slots that merely moved are announced again */
+	if (!devs[i].gts_len && gts_waiting) {
+		gts_waiting--;
+		if (nla_get_u8(attrs[IEEE802154_ATTR_STATUS])) {
+			gts_denied++;
+			return;
+		}
+		gts_granted++;
+	}
+	devs[i].gts_start = nla_get_u8(attrs[IEEE802154_ATTR_DURATION]);
+	devs[i].gts_len = gts_char & IEEE802154_GTS_LEN;
+}
+
+/* Every poll_ms, each associated device that sleeps asks for its data */
+static void mock_poll(void)
+{
+	struct nl_msg *msg;
+	unsigned int i;
+
+	for (i = 1; i < ndev; i += 2) {
+		if (devs[i].state != DEV_ASSOCIATED)
+			continue;
+		msg = mock_msg(IEEE802154_POLL_REQ);
+		if (!msg)
+			return;
+		nla_put_u16(msg, IEEE802154_ATTR_SRC_SHORT_ADDR, devs[i].short_addr);
+		if (!mock_sendmsg(msg))
+			polls++;
+		nlmsg_free(msg);
+	}
+}
+
+/* The final slot map, in slot order, checked for overlaps */
+static void mock_gts_report(void)
+{
+	unsigned int slot, i, end = 0, overlap = 0;
+
+	if (!ngts)
+		return;
+
+	log_msg(0, "mock: %u GTS granted, %u denied, %u unanswered\n",
+			gts_granted, gts_denied, gts_waiting);
+	for (slot = 0; slot < 16; slot++)
+		for (i = 0; i < ngts && i < ndev; i++) {
+			if (!devs[i].gts_len || devs[i].gts_start != slot)
+				continue;
+			if (slot < end)
+				overlap++;
+			end = slot + devs[i].gts_len;
+			log_msg(0, "mock: slots %2u-%2u device %u (0x%04x) %s\n",
+					slot, end - 1, i, devs[i].short_addr,
+					i % 2 ? "rx" : "tx");
+		}
+	if (overlap || end > 16)
+		log_msg(0, "mock: GTS overlap in the slot map!\n");
+}
+
+/* Returns 1 for an ASSOCIATE_RESP that answered a pending request */
+static int mock_response(const void *buf, ssize_t len, uint64_t now,
+		unsigned int *answered, unsigned int *refused)
+{
+	struct nlattr *attrs[IEEE802154_ATTR_MAX + 1];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct mock_dev *d;
+	uint64_t hwaddr;
+
+	if (!nlmsg_ok(nlh, len))
+		return 0;
+	if (((struct genlmsghdr *)nlmsg_data(nlh))->cmd == IEEE802154_GTS_CONF) {
+		if (!genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy))
+			mock_gts_conf(attrs);
+		return 0;
+	}
+	if (((struct genlmsghdr *)nlmsg_data(nlh))->cmd != IEEE802154_ASSOCIATE_RESP)
+		return 0;
+	if (genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy) ||
+	    !attrs[IEEE802154_ATTR_DEST_HW_ADDR] ||
+	    !attrs[IEEE802154_ATTR_DEST_SHORT_ADDR])
+		return 0;
+
+	hwaddr = nla_get_u64(attrs[IEEE802154_ATTR_DEST_HW_ADDR]);
+	if ((hwaddr & ~0xffffffffULL) != MOCK_HWADDR ||
+	    (hwaddr & 0xffffffffULL) >= ndev)
+		return 0;
+
+	d = &devs[hwaddr & 0xffffffffULL];
+	if (d->state != DEV_PENDING)
+		return 0;
+
+	latency[*answered] = now - d->sent_ns;
+	if (nla_get_u16(attrs[IEEE802154_ATTR_DEST_SHORT_ADDR]) == 0xffff) {
+		(*refused)++;
+		d->state = DEV_IDLE;
+	} else if (loss && *answered % 100 < loss) {
+		mock_comm_status(hwaddr, *answered);
+		d->state = DEV_IDLE;
+	} else {
+		mock_comm_status(hwaddr, *answered);
+		d->state = DEV_ASSOCIATED;
+		d->short_addr = nla_get_u16(attrs[IEEE802154_ATTR_DEST_SHORT_ADDR]);
+		mock_gts_indic(hwaddr & 0xffffffffULL);
+	}
+	(*answered)++;
+
+	return 1;
+}
+
+static void *mock_generator(void *arg)
+{
+	uint64_t period = rate ? 1000000000ULL / rate : 0;
+	uint64_t next = 0, first = 0, last = 0, next_poll = 0, now;
+	unsigned int sent = 0, answered = 0, refused = 0;
+	struct pollfd pfd = { .fd = sv[1] };
+	char buf[4096];
+	int err;
+
+	err = mock_start();
+	if (err < 0) {
+		log_msg(0, "mock: no START_REQ: %s\n", strerror(-err));
+		goto out;
+	}
+
+	first = next = last = next_poll = coord_now_ns();
+
+	while (!__atomic_load_n(&gen_stop, __ATOMIC_RELAXED)) {
+		struct timespec ts, *tmo = NULL;
+		ssize_t len;
+
+		now = coord_now_ns();
+
+		while (sent < count && now >= next) {
+			unsigned int i = sent % ndev;
+
+			if (devs[i].state == DEV_ASSOCIATED) {
+				err = mock_indic(IEEE802154_DISASSOCIATE_INDIC, i);
+				if (err < 0)
+					break;
+				devs[i].state = DEV_IDLE;
+				devs[i].gts_len = 0;
+			}
+
+			err = mock_indic(IEEE802154_ASSOCIATE_INDIC, i);
+			if (err < 0)
+				break;
+
+			devs[i].state = DEV_PENDING;
+			devs[i].sent_ns = now;
+			sent++;
+			next += period;
+		}
+		if (err < 0 && err != -EAGAIN) {
+			log_msg(0, "mock: send: %s\n", strerror(-err));
+			break;
+		}
+
+		if (poll_ms && now >= next_poll) {
+			mock_poll();
+			next_poll = now + poll_ms * 1000000ULL;
+		}
+
+		while ((len = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			now = coord_now_ns();
+			if (mock_response(buf, len, now, &answered, &refused))
+				last = now;
+		}
+		if (len == 0)
+			break;
+
+		if (sent == count &&
+		    ((answered == sent && !gts_waiting) ||
+		     coord_now_ns() - last > MOCK_LINGER_NS))
+			break;
+
+		/* Wake up for answers, for room to send or at the next deadline */
+		pfd.events = POLLIN;
+		if (err == -EAGAIN) {
+			pfd.events |= POLLOUT;
+		} else if (sent < count) {
+			now = coord_now_ns();
+			ts.tv_sec = next > now ? (next - now) / 1000000000ULL : 0;
+			ts.tv_nsec = next > now ? (next - now) % 1000000000ULL : 0;
+			tmo = &ts;
+		}
+		if (!tmo && sent == count) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = 100000000;
+			tmo = &ts;
+		}
+		ppoll(&pfd, 1, tmo, NULL);
+		err = 0;
+	}
+
+	mock_report(sent, answered, refused, first, last);
+	mock_gts_report();
+	if (poll_ms)
+		log_msg(0, "mock: %u data requests, %u frames received\n",
+				polls, __atomic_load_n(&frames_rx, __ATOMIC_RELAXED));
+out:
+	/* The coordinator sees end of file and shuts down */
+	shutdown(sv[1], SHUT_RDWR);
+	return NULL;
+}
+
+/*
+ * arg is rate:count[:devices[:loss[:gts[:poll]]]], a rate of 0 sends as
+ * fast as possible; loss is the percentage of responses that never
+ * arrive, the first gts devices ask for a GTS once they are associated,
+ * and sleeping devices poll for data every poll milliseconds.
+ */
+static int mock_open(const char *arg)
+{
+	sigset_t all, old;
+	char *end;
+	int err;
+
+	rate = strtoul(arg, &end, 0);
+	if (*end != ':')
+		return -NLE_INVAL;
+	count = strtoul(end + 1, &end, 0);
+	ndev = 256;
+	if (*end == ':')
+		ndev = strtoul(end + 1, &end, 0);
+	if (*end == ':')
+		loss = strtoul(end + 1, &end, 0);
+	if (*end == ':')
+		ngts = strtoul(end + 1, &end, 0);
+	if (*end == ':')
+		poll_ms = strtoul(end + 1, &end, 0);
+	if (*end || !count || !ndev || loss > 100)
+		return -NLE_INVAL;
+
+	devs = calloc(ndev, sizeof(*devs));
+	latency = calloc(count, sizeof(*latency));
+	if (!devs || !latency)
+		goto nomem;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		err = -nl_syserr2nlerr(errno);
+		goto fail;
+	}
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&gen, NULL, mock_generator, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		close(sv[0]);
+		close(sv[1]);
+		sv[0] = sv[1] = -1;
+		goto nomem;
+	}
+	gen_running = 1;
+
+	log_msg(0, "mock: %u associations of %u devices at %u/s\n", count, ndev, rate);
+
+	return MOCK_FAMILY;
+
+nomem:
+	err = -NLE_NOMEM;
+fail:
+	free(devs);
+	free(latency);
+	devs = NULL;
+	latency = NULL;
+	return err;
+}
+
+static int mock_get_fd(void)
+{
+	return sv[0];
+}
+
+static int mock_send(struct nl_msg *msg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+
+	if (send(sv[0], nlh, nlh->nlmsg_len, MSG_NOSIGNAL) < 0)
+		return -nl_syserr2nlerr(errno);
+
+	return nlh->nlmsg_len;
+}
+
+static int mock_recv(void)
+{
+	static char buf[4096];
+	int i;
+
+	for (i = 0; i < MOCK_BATCH; i++) {
+		ssize_t len = recv(sv[0], buf, sizeof(buf), MSG_DONTWAIT);
+		struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+		struct nl_msg *msg;
+
+		if (len == 0)
+			return -1;
+		if (len < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		if (!nlmsg_ok(nlh, len))
+			continue;
+
+		msg = nlmsg_convert(nlh);
+		if (!msg)
+			continue;
+		coord_mlme_input(msg);
+		nlmsg_free(msg);
+	}
+
+	return 0;
+}
+
+/* The radio side of an answer to a data request */
+static int mock_data(uint16_t pan_id, uint16_t src, uint16_t dst,
+		const void *buf, size_t len)
+{
+	__atomic_fetch_add(&frames_rx, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static void mock_close(void)
+{
+	if (gen_running) {
+		__atomic_store_n(&gen_stop, 1, __ATOMIC_RELAXED);
+		shutdown(sv[0], SHUT_RDWR);
+		pthread_join(gen, NULL);
+		gen_running = 0;
+	}
+
+	if (sv[0] >= 0) {
+		close(sv[0]);
+		close(sv[1]);
+		sv[0] = sv[1] = -1;
+	}
+
+	free(devs);
+	free(latency);
+	devs = NULL;
+	latency = NULL;
+}
+
+const struct coord_transport coord_mock_transport = {
+	.name	= "mock",
+	.open	= mock_open,
+	.get_fd	= mock_get_fd,
+	.send	= mock_send,
+	.recv	= mock_recv,
+	.close	= mock_close,
+	.data	= mock_data,
+};
@@ -0,0 +1,205 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * izcoordinator transport over the kernel's generic netlink interface.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+
+#include <ieee802154.h>
+#include <nl802154.h>
+#include <libcommon.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+static struct nl_sock *nl;
+static uint32_t seq_expected;
+/* Data frames to devices, opened on first use */
+static int data_fd = -1;
+
+static int valid_cb(struct nl_msg *msg, void *arg)
+{
+	return coord_mlme_input(msg);
+}
+
+static int seq_check(struct nl_msg *msg, void *arg)
+{
+	if (nlmsg_get_src(msg)->nl_groups)
+		return NL_OK;
+
+	uint32_t seq = nlmsg_hdr(msg)->nlmsg_seq;
+
+	if (seq == seq_expected) {
+		seq_expected ++;
+		return NL_OK;
+	}
+
+	coord_count(COORD_CNT_SEQ_MISMATCH);
+	log_msg(0, "Sequence number mismatch: %x != %x\n", seq, seq_expected);
+
+	return NL_SKIP;
+}
+
+static int netlink_open(const char *arg)
+{
+	int family, group, err;
+
+	nl = nl_socket_alloc();
+	if (!nl)
+		return -NLE_NOMEM;
+
+	err = genl_connect(nl);
+	if (err < 0)
+		goto fail;
+
+	family = nl_get_family_id(nl, IEEE802154_NL_NAME);
+	group = nl_get_multicast_id(nl, IEEE802154_NL_NAME, IEEE802154_MCAST_COORD_NAME);
+	if (family < 0 || group < 0) {
+		err = -NLE_OBJ_NOTFOUND;
+		goto fail;
+	}
+	nl_socket_add_membership(nl, group);
+
+	seq_expected = nl_socket_use_seq(nl) + 1;
+
+	nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM, valid_cb, NULL);
+	nl_socket_modify_cb(nl, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+
+	return family;
+
+fail:
+	nl_forget_families(nl);
+	nl_socket_free(nl);
+	nl = NULL;
+	return err;
+}
+
+static int netlink_adopt(int fd, int family)
+{
+	int err;
+
+	nl = nl_socket_alloc();
+	if (!nl)
+		return -NLE_NOMEM;
+
+	/* Group membership belongs to the socket, so it is still there */
+	err = nl_socket_set_fd(nl, NETLINK_GENERIC, fd);
+	if (err < 0) {
+		nl_socket_free(nl);
+		nl = NULL;
+		return err;
+	}
+
+	seq_expected = nl_socket_use_seq(nl) + 1;
+
+	nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM, valid_cb, NULL);
+	nl_socket_modify_cb(nl, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+
+	return family;
+}
+
+static int netlink_get_fd(void)
+{
+	return nl_socket_get_fd(nl);
+}
+
+static int netlink_send(struct nl_msg *msg)
+{
+	return nl_send_auto_complete(nl, msg);
+}
+
+static int netlink_recv(void)
+{
+	int err = nl_recvmsgs_default(nl);
+
+	if (err < 0) {
+		coord_count(COORD_CNT_NL_ERROR);
+		log_msg(0, "nl_recvmsgs: %s\n", nl_geterror(err));
+	}
+
+	return 0;
+}
+
+static int netlink_data(uint16_t pan_id, uint16_t src, uint16_t dst,
+		const void *buf, size_t len)
+{
+	struct sockaddr_ieee802154 a;
+
+	memset(&a, 0, sizeof(a));
+	a.family = AF_IEEE802154;
+	a.addr.addr_type = IEEE802154_ADDR_SHORT;
+	a.addr.pan_id = pan_id;
+
+	if (data_fd < 0) {
+		data_fd = socket(PF_IEEE802154, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (data_fd < 0)
+			return -errno;
+
+		/* Our own address picks the interface */
+		a.addr.short_addr = src;
+		if (bind(data_fd, (struct sockaddr *)&a, sizeof(a)) < 0) {
+			int err = -errno;
+
+			close(data_fd);
+			data_fd = -1;
+			return err;
+		}
+	}
+
+	a.addr.short_addr = dst;
+	if (sendto(data_fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&a, sizeof(a)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void netlink_close(void)
+{
+	if (data_fd >= 0) {
+		close(data_fd);
+		data_fd = -1;
+	}
+
+	if (!nl)
+		return;
+
+	nl_close(nl);
+	nl_forget_families(nl);
+	nl_socket_free(nl);
+	nl = NULL;
+}
+
+const struct coord_transport coord_netlink_transport = {
+	.name	= "netlink",
+	.open	= netlink_open,
+	.get_fd	= netlink_get_fd,
+	.send	= netlink_send,
+	.recv	= netlink_recv,
+	.close	= netlink_close,
+	.adopt	= netlink_adopt,
+	.data	= netlink_data,
+};
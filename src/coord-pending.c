@@ -0,0 +1,157 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Associations waiting for the MAC to report whether the device got
+ * our ASSOCIATE_RESP; their leases are dropped only if it did not.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/*
+ * The response is sent indirectly, so the device has to poll for it
+ * within macResponseWaitTime: about 1 s on 2.4 GHz, 3 s on 868 MHz.
+ * After that the MAC reports its COMM_STATUS, or the device is gone.
+ */
+#define PENDING_TIMEOUT_MS	5000
+
+struct pending_assoc {
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	uint64_t sent_ns;	/* last ASSOCIATE_RESP */
+	struct coord_timer timer;
+};
+
+static struct simple_hash *pending;
+/* Retries closer than this to the last response are dropped, 0: never */
+static uint64_t dedup_ns;
+
+static void pending_free(struct pending_assoc *p)
+{
+	coord_timer_del(&p->timer);
+	shash_drop(pending, p->hwaddr);
+	free(p);
+}
+
+static void pending_expire(void *arg)
+{
+	struct pending_assoc *p = arg;
+
+	/*
+	 * Without a COMM_STATUS we can't tell whether the device got the
+	 * response: if it did, it uses the address, so handing it out
+	 * again could give two devices the same one. Keep the lease.
+	 */
+	if (!addrdb_commit(p->hwaddr)) {
+		coord_count(COORD_CNT_ASSOC_TIMEOUT);
+		log_msg(0, "No status for association, lease kept\n");
+	}
+	pending_free(p);
+}
+
+int coord_pending_init(void)
+{
+	pending = shash_new(hw_hash, hw_eq);
+
+	return pending ? 0 : -ENOMEM;
+}
+
+void coord_pending_set_window(unsigned int ms)
+{
+	dedup_ns = ms * 1000000ULL;
+}
+
+/*
+ * A device that retries before our response could reach it would only
+ * get the same address again, at the cost of another response on air.
+ */
+int coord_pending_duplicate(const uint8_t *hwa, uint64_t now_ns)
+{
+	struct pending_assoc *p;
+
+	if (!dedup_ns)
+		return 0;
+
+	p = shash_get(pending, hwa);
+
+	return p && now_ns - p->sent_ns < dedup_ns;
+}
+
+/* Called for every ASSOCIATE_RESP; a retrying device restarts the clock */
+int coord_pending_add(const uint8_t *hwa)
+{
+	struct pending_assoc *p = shash_get(pending, hwa);
+
+	if (!p) {
+		p = calloc(1, sizeof(*p));
+		if (!p)
+			return -ENOMEM;
+		memcpy(p->hwaddr, hwa, IEEE802154_ADDR_LEN);
+		p->timer.cb = pending_expire;
+		p->timer.arg = p;
+		shash_insert(pending, p->hwaddr, p);
+	}
+
+	p->sent_ns = coord_now_ns();
+	coord_timer_add(&p->timer, PENDING_TIMEOUT_MS);
+
+	return 0;
+}
+
+/* COMM_STATUS for hwa: keep the lease if the response got through */
+void coord_pending_status(const uint8_t *hwa, uint8_t status)
+{
+	struct pending_assoc *p = shash_get(pending, hwa);
+
+	if (!p)
+		return;
+
+	if (status == 0) {
+		addrdb_commit(hwa);
+	} else if (!addrdb_release(hwa)) {
+		coord_count(COORD_CNT_ASSOC_ROLLBACK);
+		coord_trace(TRACE_ASSOC_ROLLBACK, hwa, 0, status, 0);
+		log_msg(0, "Association failed with status %02x, address released\n", status);
+	}
+
+	pending_free(p);
+}
+
+static void pending_commit(const void *key, void *data, void *arg)
+{
+	addrdb_commit(key);
+	pending_free(data);
+}
+
+/*
+ * Before a handoff: the successor knows nothing of our responses, so
+ * the leases they promised are kept as if their status had come.
+ */
+void coord_pending_commit_all(void)
+{
+	if (pending)
+		shash_for_each(pending, pending_commit, NULL);
+}
@@ -0,0 +1,425 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Lease persistence thread for izcoordinator.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <logging.h>
+#include <probes.h>
+
+#include "coordinator.h"
+
+/* Must stay a power of two, see spsc_ring_new() */
+#define PERSIST_RING_SIZE	4096
+/* Retry period if the lease file could not be written */
+#define PERSIST_RETRY_MS	1000
+/* How often to look whether the thread caught up after an overflow */
+#define PERSIST_RESYNC_MS	100
+
+struct lease_update {
+	uint8_t ev;
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	time_t stamp;
+};
+
+/*
+ * Private copy of the lease table, indexed by short address. It is
+ * only touched by the persistence thread once that is running, so the
+ * netlink thread never has to share addrdb with it.
+ */
+struct shadow_lease {
+	uint8_t valid;
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	time_t stamp;
+};
+
+static struct shadow_lease shadow[65536];
+
+/*
+ * The whole table, handed to the thread after the ring overflowed.
+ * It replaces the shadow before any update queued after it is applied.
+ */
+struct persist_snapshot {
+	unsigned int n;
+	struct lease_update lease[];
+};
+
+static struct spsc_ring *updates;
+static const char *lease_path;
+static char *tmp_path;
+static pthread_t persist_thread;
+static int running;
+
+static int wake_fd[2] = { -1, -1 };
+static int sleeping;
+static int stop_requested;
+static volatile sig_atomic_t flush_requested;
+
+/* Netlink thread only: updates are dropped until a snapshot went out */
+static int resync;
+static struct coord_timer resync_timer;
+static struct persist_snapshot *snapshot;
+
+static void persist_wake(void)
+{
+	char c = 0;
+
+	/* Non-blocking pipe: if it is full, a wakeup is pending anyway */
+	if (write(wake_fd[1], &c, 1) < 0 && errno != EAGAIN)
+		log_msg(0, "persist: wakeup failed: %s\n", strerror(errno));
+}
+
+static void persist_snap_add(const uint8_t *hwa, uint16_t short_addr,
+		time_t stamp, void *arg)
+{
+	struct persist_snapshot *snap = arg;
+	struct lease_update *u = &snap->lease[snap->n++];
+
+	u->ev = ADDRDB_LEASE_ADD;
+	memcpy(u->hwaddr, hwa, IEEE802154_ADDR_LEN);
+	u->short_addr = short_addr;
+	u->stamp = stamp;
+}
+
+/*
+ * Once the thread has emptied the ring, whatever it dropped is only in
+ * addrdb, so it gets all of addrdb. Until then, keep dropping updates:
+ * the snapshot will have them.
+ */
+static void persist_resync(void *arg)
+{
+	struct persist_snapshot *snap;
+	unsigned int n;
+
+	if (!spsc_ring_empty(updates) ||
+	    __atomic_load_n(&snapshot, __ATOMIC_ACQUIRE)) {
+		coord_timer_add(&resync_timer, PERSIST_RESYNC_MS);
+		return;
+	}
+
+	snap = malloc(sizeof(*snap) +
+			addrdb_lease_count() * sizeof(struct lease_update));
+	if (!snap) {
+		coord_timer_add(&resync_timer, PERSIST_RESYNC_MS);
+		return;
+	}
+	snap->n = 0;
+	addrdb_for_each(persist_snap_add, snap);
+	n = snap->n;
+
+	/* From here on the thread owns it */
+	__atomic_store_n(&snapshot, snap, __ATOMIC_RELEASE);
+	resync = 0;
+	persist_wake();
+	log_msg(0, "persist: %u leases resent after an overflow\n", n);
+}
+
+void coord_persist_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp)
+{
+	struct lease_update u;
+
+	if (!running || resync)
+		return;
+
+	u.ev = ev;
+	memcpy(u.hwaddr, hwa, IEEE802154_ADDR_LEN);
+	u.short_addr = short_addr;
+	u.stamp = stamp;
+
+	/*
+	 * The ring is sized far above anything the radio can deliver
+	 * between two lease file writes, so it only fills up if the
+	 * persistence thread is stuck in the filesystem. Waiting for it
+	 * would stall the PAN: drop the update and resend the whole
+	 * table once the thread is back.
+	 */
+	if (spsc_ring_push(updates, &u) < 0) {
+		log_msg(0, "persist: update queue full, lease file falls behind\n");
+		resync = 1;
+		coord_timer_add(&resync_timer, PERSIST_RESYNC_MS);
+		persist_wake();
+		return;
+	}
+
+	/* Pairs with the fence in persist_main() before going to sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleeping, __ATOMIC_RELAXED))
+		persist_wake();
+}
+
+void coord_persist_flush(void)
+{
+	flush_requested = 1;
+	if (wake_fd[1] >= 0) {
+		char c = 0;
+		if (write(wake_fd[1], &c, 1) < 0)
+			; /* nothing sane to do in a signal handler */
+	}
+}
+
+static int persist_load_snapshot(void)
+{
+	struct persist_snapshot *snap;
+	unsigned int i;
+
+	snap = __atomic_exchange_n(&snapshot, NULL, __ATOMIC_ACQUIRE);
+	if (!snap)
+		return 0;
+
+	memset(shadow, 0, sizeof(shadow));
+	for (i = 0; i < snap->n; i++) {
+		struct lease_update *u = &snap->lease[i];
+
+		shadow[u->short_addr].valid = 1;
+		memcpy(shadow[u->short_addr].hwaddr, u->hwaddr, IEEE802154_ADDR_LEN);
+		shadow[u->short_addr].stamp = u->stamp;
+	}
+	free(snap);
+
+	return 1;
+}
+
+static int persist_drain(void)
+{
+	struct lease_update u;
+	int changed = 0;
+
+	/*
+	 * The snapshot is only published on an empty ring, so whatever is
+	 * still in the ring once it is visible is newer. Look for it before
+	 * every pop: an update popped first may be the one that emptied the
+	 * ring, and is then older than the snapshot.
+	 */
+	for (;;) {
+		struct shadow_lease *l;
+
+		changed |= persist_load_snapshot();
+		if (spsc_ring_pop(updates, &u))
+			break;
+
+		l = &shadow[u.short_addr];
+		switch (u.ev) {
+		case ADDRDB_LEASE_ADD:
+		case ADDRDB_LEASE_REFRESH:
+			l->valid = 1;
+			memcpy(l->hwaddr, u.hwaddr, IEEE802154_ADDR_LEN);
+			l->stamp = u.stamp;
+			break;
+		case ADDRDB_LEASE_DEL:
+			l->valid = 0;
+			break;
+		}
+		changed = 1;
+	}
+
+	return changed;
+}
+
+/* Write the whole table to a temporary file and rename it into place */
+static int persist_write(void)
+{
+	uint64_t start = coord_now_ns();
+	long bytes;
+	FILE *f;
+	int i;
+
+	coord_trace(TRACE_FLUSH_START, NULL, 0, 0, 0);
+	PROBE(izcoordinator, lease__write__start);
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		log_msg(0, "persist: can't open %s: %s\n", tmp_path, strerror(errno));
+		coord_trace(TRACE_FLUSH_END, NULL, 0, (coord_now_ns() - start) / 1000, errno);
+		return -1;
+	}
+
+	for (i = 0; i < 65536; i++) {
+		if (shadow[i].valid)
+			addrdb_write_lease(f, shadow[i].hwaddr, i, shadow[i].stamp);
+	}
+
+	if (fflush(f) || fsync(fileno(f))) {
+		log_msg(0, "persist: can't write %s: %s\n", tmp_path, strerror(errno));
+		coord_trace(TRACE_FLUSH_END, NULL, 0, (coord_now_ns() - start) / 1000, errno);
+		fclose(f);
+		unlink(tmp_path);
+		return -1;
+	}
+	bytes = ftell(f);
+	fclose(f);
+
+	if (rename(tmp_path, lease_path)) {
+		log_msg(0, "persist: can't rename %s: %s\n", tmp_path, strerror(errno));
+		coord_trace(TRACE_FLUSH_END, NULL, 0, (coord_now_ns() - start) / 1000, errno);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	start = coord_now_ns() - start;
+	coord_observe(COORD_HIST_FLUSH, start);
+	coord_trace(TRACE_FLUSH_END, NULL, 0, start / 1000, 0);
+	PROBE2(izcoordinator, lease__write__end, bytes, start);
+
+	return 0;
+}
+
+static void *persist_main(void *arg)
+{
+	struct pollfd pfd = { .fd = wake_fd[0], .events = POLLIN };
+	int dirty = 0;
+	char buf[64];
+
+	while (1) {
+		dirty |= persist_drain();
+
+		if (flush_requested) {
+			flush_requested = 0;
+			dirty = 1;
+		}
+
+		/* Everything queued while we write gets batched into the next pass */
+		if (dirty && !persist_write())
+			dirty = 0;
+
+		if (__atomic_load_n(&stop_requested, __ATOMIC_ACQUIRE) &&
+		    spsc_ring_empty(updates))
+			break;
+
+		__atomic_store_n(&sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (spsc_ring_empty(updates) && !flush_requested &&
+		    !__atomic_load_n(&stop_requested, __ATOMIC_ACQUIRE))
+			poll(&pfd, 1, dirty ? PERSIST_RETRY_MS : -1);
+		__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+
+		while (read(wake_fd[0], buf, sizeof(buf)) > 0)
+			;
+	}
+
+	return NULL;
+}
+
+static void persist_seed(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	shadow[short_addr].valid = 1;
+	memcpy(shadow[short_addr].hwaddr, hwa, IEEE802154_ADDR_LEN);
+	shadow[short_addr].stamp = stamp;
+}
+
+int coord_persist_start(const char *lease_file)
+{
+	sigset_t all, old;
+	int i, err;
+
+	lease_path = lease_file;
+	stop_requested = 0;
+	resync = 0;
+	resync_timer.cb = persist_resync;
+	memset(shadow, 0, sizeof(shadow));
+	if (asprintf(&tmp_path, "%s.tmp", lease_file) < 0) {
+		tmp_path = NULL;
+		return -ENOMEM;
+	}
+
+	updates = spsc_ring_new(PERSIST_RING_SIZE, sizeof(struct lease_update));
+	if (!updates) {
+		err = -ENOMEM;
+		goto out_path;
+	}
+
+	if (pipe(wake_fd)) {
+		err = -errno;
+		goto out_ring;
+	}
+	for (i = 0; i < 2; i++)
+		fcntl(wake_fd[i], F_SETFL, fcntl(wake_fd[i], F_GETFL) | O_NONBLOCK);
+
+	/* Thread is not running yet, so the table is still ours */
+	addrdb_for_each(persist_seed, NULL);
+
+	/* Signals are handled by the netlink thread only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&persist_thread, NULL, persist_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		err = -err;
+		goto out_pipe;
+	}
+
+	running = 1;
+
+	return 0;
+
+out_pipe:
+	close(wake_fd[0]);
+	close(wake_fd[1]);
+	wake_fd[0] = wake_fd[1] = -1;
+out_ring:
+	spsc_ring_free(updates);
+	updates = NULL;
+out_path:
+	free(tmp_path);
+	tmp_path = NULL;
+	return err;
+}
+
+void coord_persist_stop(void)
+{
+	if (!running)
+		return;
+
+	running = 0;
+
+	__atomic_store_n(&stop_requested, 1, __ATOMIC_RELEASE);
+	persist_wake();
+	pthread_join(persist_thread, NULL);
+
+	/* Dropped updates never made it: the table is ours again, write it */
+	if (resync) {
+		coord_timer_del(&resync_timer);
+		resync = 0;
+		memset(shadow, 0, sizeof(shadow));
+		addrdb_for_each(persist_seed, NULL);
+		persist_write();
+	}
+
+	/* So that it can be started again, possibly on another file */
+	spsc_ring_free(updates);
+	updates = NULL;
+	free(tmp_path);
+	tmp_path = NULL;
+	close(wake_fd[0]);
+	close(wake_fd[1]);
+	wake_fd[0] = wake_fd[1] = -1;
+}
@@ -0,0 +1,169 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Association admission rate limiting for izcoordinator.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <ieee802154.h>
+
+#include "coordinator.h"
+
+/*
+ * Per-device buckets live in a fixed open-addressing table that acts
+ * as a cache: a bucket that was idle long enough to be full again is
+ * equivalent to a missing one, so under pressure we simply evict the
+ * least recently used entry of the probe window.
+ */
+#define RL_TABLE_BITS	12
+#define RL_TABLE_SIZE	(1 << RL_TABLE_BITS)
+#define RL_PROBE	8
+
+/* Tokens are kept in 1/1000 units, so a refill is elapsed_ms * rate */
+struct rl_bucket {
+	uint64_t eui;
+	uint64_t last_ms;	/* 0 means the slot is free */
+	uint32_t tokens;
+};
+
+struct rl_limit {
+	unsigned int rate;	/* tokens per second, 0 disables the limit */
+	unsigned int burst;
+};
+
+static struct rl_limit dev_limit, global_limit;
+static struct rl_bucket *table;
+static struct rl_bucket global_bucket;
+
+/* Parse "RATE[:BURST]"; the burst defaults to the rate */
+int coord_ratelimit_parse(const char *arg, unsigned int *rate, unsigned int *burst)
+{
+	char *end;
+
+	*rate = strtoul(arg, &end, 0);
+	if (*end == ':')
+		*burst = strtoul(end + 1, &end, 0);
+	else
+		*burst = *rate;
+
+	if (*end || (*rate && !*burst) || *burst > 1000000)
+		return -EINVAL;
+
+	return 0;
+}
+
+int coord_ratelimit_init(unsigned int dev_rate, unsigned int dev_burst,
+		unsigned int global_rate, unsigned int global_burst)
+{
+	/* On failure the limits in force stay as they are */
+	if (dev_rate && !table) {
+		table = calloc(RL_TABLE_SIZE, sizeof(*table));
+		if (!table)
+			return -ENOMEM;
+	}
+
+	dev_limit.rate = dev_rate;
+	dev_limit.burst = dev_burst;
+	global_limit.rate = global_rate;
+	global_limit.burst = global_burst;
+
+	memset(&global_bucket, 0, sizeof(global_bucket));
+
+	return 0;
+}
+
+static int rl_take(struct rl_bucket *b, const struct rl_limit *l, uint64_t now_ms)
+{
+	uint64_t tokens = b->tokens;
+	uint64_t full = (uint64_t)l->burst * 1000;
+
+	if (!b->last_ms)
+		tokens = full;
+	else
+		tokens += (now_ms - b->last_ms) * l->rate;
+	if (tokens > full)
+		tokens = full;
+
+	b->last_ms = now_ms;
+
+	if (tokens < 1000) {
+		b->tokens = tokens;
+		return 0;
+	}
+	b->tokens = tokens - 1000;
+
+	return 1;
+}
+
+static struct rl_bucket *rl_lookup(uint64_t eui)
+{
+	unsigned int h = (eui * 0x9e3779b97f4a7c15ULL) >> (64 - RL_TABLE_BITS);
+	struct rl_bucket *victim = NULL;
+	int i;
+
+	for (i = 0; i < RL_PROBE; i++) {
+		struct rl_bucket *b = &table[(h + i) & (RL_TABLE_SIZE - 1)];
+
+		if (!b->last_ms) {
+			b->eui = eui;
+			return b;
+		}
+		if (b->eui == eui)
+			return b;
+		if (!victim || b->last_ms < victim->last_ms)
+			victim = b;
+	}
+
+	victim->eui = eui;
+	victim->last_ms = 0;
+
+	return victim;
+}
+
+/*
+ * Returns 1 if an association request from hwa may go on. Devices are
+ * checked first, so a single babbling device can not drain the global
+ * bucket for everyone else.
+ */
+int coord_ratelimit_admit(const uint8_t *hwa, uint64_t now_ns)
+{
+	/* +1 keeps last_ms non-zero even right after boot */
+	uint64_t now_ms = now_ns / 1000000 + 1;
+
+	if (dev_limit.rate) {
+		uint64_t eui;
+
+		memcpy(&eui, hwa, sizeof(eui));
+		if (!rl_take(rl_lookup(eui), &dev_limit, now_ms)) {
+			coord_count(COORD_CNT_RATELIMIT_DEV);
+			return 0;
+		}
+	}
+
+	if (global_limit.rate && !rl_take(&global_bucket, &global_limit, now_ms)) {
+		coord_count(COORD_CNT_RATELIMIT_GLOBAL);
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,151 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Real-time operating mode for izcoordinator: locked and prefaulted
+ * memory, SCHED_FIFO and CPU pinning for the netlink thread.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <logging.h>
+
+#include "coordinator.h"
+
+/* Stack the netlink thread may use without taking a page fault */
+#define RT_STACK_PREFAULT	(256 * 1024)
+/* Heap per short address in the pool: the lease and its hash nodes */
+#define RT_HEAP_PER_LEASE	128
+
+static cpu_set_t rt_cpus;
+static int rt_cpus_set;
+
+/* arg is a list of CPUs and ranges, like 1,3-5 */
+int coord_rt_parse_cpus(const char *arg)
+{
+	const char *p = arg;
+
+	CPU_ZERO(&rt_cpus);
+
+	while (*p) {
+		char *end;
+		long first, last;
+
+		first = last = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last; first++)
+			CPU_SET(first, &rt_cpus);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		p = end;
+	}
+
+	if (!CPU_COUNT(&rt_cpus))
+		return -1;
+
+	rt_cpus_set = 1;
+	return 0;
+}
+
+static void rt_prefault_stack(void)
+{
+	volatile char buf[RT_STACK_PREFAULT];
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i += 4096)
+		buf[i] = 0;
+}
+
+/*
+ * malloc must never give memory back to the kernel, otherwise the
+ * next allocation faults again; then grow the heap to what a full
+ * address pool needs while everything is locked.
+ */
+static void rt_prefault_heap(size_t size)
+{
+	char *p;
+	size_t i;
+
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	p = malloc(size);
+	if (!p)
+		return;
+	for (i = 0; i < size; i += 4096)
+		p[i] = 0;
+	free(p);
+}
+
+/*
+ * Switches the calling thread to real time. Threads started earlier
+ * keep their normal policy and CPUs; memory locking covers them too.
+ */
+int coord_rt_start(int priority)
+{
+	struct sched_param sp = { .sched_priority = priority };
+	int err;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		err = -errno;
+		log_msg(0, "rt: mlockall: %s\n", strerror(errno));
+		return err;
+	}
+
+	rt_prefault_stack();
+	rt_prefault_heap((size_t)addrdb_pool_size() * RT_HEAP_PER_LEASE);
+
+	if (rt_cpus_set) {
+		err = pthread_setaffinity_np(pthread_self(), sizeof(rt_cpus), &rt_cpus);
+		if (err) {
+			log_msg(0, "rt: can't set CPU affinity: %s\n", strerror(err));
+			return -err;
+		}
+	}
+
+	if (priority) {
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (err) {
+			log_msg(0, "rt: can't switch to SCHED_FIFO %d: %s\n",
+					priority, strerror(err));
+			return -err;
+		}
+	}
+
+	log_msg(0, "rt: memory locked, priority %d\n", priority);
+
+	return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Hot standby: follow the lease feed of a primary izcoordinator and
+ * take over its PAN when the primary goes silent.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ieee802154.h>
+#include <libcommon.h>
+#include <addrdb.h>
+#include <logging.h>
+
+#include "coordinator.h"
+
+/* How often we check on the primary, and try to reach it again */
+#define STANDBY_RETRY_MS	100
+/* Three alive lines missed: the primary is gone */
+#define STANDBY_FAILOVER_MS	600
+
+enum standby_state {
+	STANDBY_DOWN,		/* not connected */
+	STANDBY_CONNECTING,
+	STANDBY_SNAPSHOT,	/* receiving a full table */
+	STANDBY_LIVE,
+	STANDBY_PROMOTED,
+};
+
+static const char *const state_name[] = {
+	[STANDBY_DOWN] = "down",
+	[STANDBY_CONNECTING] = "connecting",
+	[STANDBY_SNAPSHOT] = "snapshot",
+	[STANDBY_LIVE] = "live",
+	[STANDBY_PROMOTED] = "promoted",
+};
+
+struct staged_lease {
+	uint8_t hwaddr[IEEE802154_ADDR_LEN];
+	uint16_t short_addr;
+	time_t stamp;
+};
+
+static const char *primary_name;
+static struct sockaddr_storage primary;
+static socklen_t primary_len;
+
+static enum standby_state state;
+static int fd = -1;
+static char in[512];
+static size_t in_len;
+
+/* Where we are in the primary's feed; epoch 0: never synced */
+static unsigned long long epoch, seq;
+static unsigned long long snap_epoch;
+static uint64_t last_heard;
+static struct coord_timer timer;
+
+/* The snapshot being received, applied as a whole at its sync line */
+static struct simple_hash *staged;
+
+static void staged_free(const void *key, void *data, void *arg)
+{
+	shash_drop(staged, key);
+	free(data);
+}
+
+static void staged_clear(void)
+{
+	shash_for_each(staged, staged_free, NULL);
+}
+
+static void standby_close(void)
+{
+	if (fd < 0)
+		return;
+
+	coord_loop_del(fd);
+	close(fd);
+	fd = -1;
+	in_len = 0;
+	state = STANDBY_DOWN;
+}
+
+/* Leases the primary no longer has, or has under another address */
+static void drop_stale(const uint8_t *hwa, uint16_t short_addr, time_t stamp, void *arg)
+{
+	struct staged_lease *l = shash_get(staged, hwa);
+
+	if (!l || l->short_addr != short_addr)
+		addrdb_free_hw((uint8_t *)hwa);
+}
+
+static void insert_staged(const void *key, void *data, void *arg)
+{
+	struct staged_lease *l = data;
+
+	addrdb_insert_quiet(l->hwaddr, l->short_addr, l->stamp);
+}
+
+static void apply_lease(const uint8_t *hwa, uint16_t short_addr, time_t stamp)
+{
+	uint16_t old;
+	time_t old_stamp;
+
+	if (!addrdb_get_hw(hwa, &old, &old_stamp) && old != short_addr)
+		addrdb_free_hw((uint8_t *)hwa);
+	addrdb_insert((uint8_t *)hwa, short_addr, stamp);
+}
+
+static int parse_lease(const char *s, uint8_t *hwa, uint16_t *short_addr, time_t *stamp)
+{
+	unsigned int sa;
+	long st;
+	int n;
+
+	n = parse_hwaddr(s, hwa);
+	if (n < 0)
+		return -1;
+	s += n;
+	if (sscanf(s, " %x %ld%n", &sa, &st, &n) != 2 || s[n] || sa > 0xffff)
+		return -1;
+
+	*short_addr = sa;
+	*stamp = st;
+
+	return 0;
+}
+
+static int standby_line(char *line)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	unsigned long long e, n;
+	uint16_t short_addr;
+	time_t stamp;
+	char ev[8];
+	int off;
+
+	if (sscanf(line, "snapshot %llx %llu", &e, &n) == 2) {
+		snap_epoch = e;
+		staged_clear();
+		state = STANDBY_SNAPSHOT;
+		return 0;
+	}
+
+	if (!strncmp(line, "lease ", 6)) {
+		struct staged_lease *l;
+
+		if (state != STANDBY_SNAPSHOT || parse_lease(line + 6, hwa, &short_addr, &stamp))
+			return -1;
+		l = shash_get(staged, hwa);
+		if (!l) {
+			l = calloc(1, sizeof(*l));
+			if (!l)
+				return -1;
+			memcpy(l->hwaddr, hwa, IEEE802154_ADDR_LEN);
+			shash_insert(staged, l->hwaddr, l);
+		}
+		l->short_addr = short_addr;
+		l->stamp = stamp;
+		return 0;
+	}
+
+	if (sscanf(line, "sync %llu", &n) == 1) {
+		if (state == STANDBY_SNAPSHOT) {
+			addrdb_for_each(drop_stale, NULL);
+			shash_for_each(staged, insert_staged, NULL);
+			log_msg(0, "standby: %u leases from %s\n",
+					shash_count(staged), primary_name);
+			staged_clear();
+			epoch = snap_epoch;
+		}
+		seq = n;
+		state = STANDBY_LIVE;
+		return 0;
+	}
+
+	if (sscanf(line, "alive %llu", &n) == 1)
+		return n == seq ? 0 : -1;
+
+	if (sscanf(line, "%llu %7s %n", &n, ev, &off) == 2) {
+		/* A gap means we missed something: subscribe again */
+		if (state != STANDBY_LIVE || n != seq + 1 ||
+		    parse_lease(line + off, hwa, &short_addr, &stamp))
+			return -1;
+		if (!strcmp(ev, "del")) {
+			uint16_t old;
+			time_t old_stamp;
+
+			if (!addrdb_get_hw(hwa, &old, &old_stamp) && old == short_addr)
+				addrdb_free_hw(hwa);
+		} else {
+			apply_lease(hwa, short_addr, stamp);
+		}
+		seq = n;
+		return 0;
+	}
+
+	log_msg(0, "standby: unexpected from %s: %s\n", primary_name, line);
+	return -1;
+}
+
+static void standby_read_cb(int rfd, short revents, void *arg)
+{
+	char *line, *nl;
+	ssize_t n;
+
+	n = recv(fd, in + in_len, sizeof(in) - 1 - in_len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (n <= 0) {
+		log_msg(0, "standby: lost %s\n", primary_name);
+		standby_close();
+		return;
+	}
+	in_len += n;
+	in[in_len] = '\0';
+	last_heard = coord_now_ns();
+
+	for (line = in; (nl = strchr(line, '\n')); line = nl + 1) {
+		*nl = '\0';
+		if (standby_line(line) < 0) {
+			standby_close();
+			return;
+		}
+	}
+
+	in_len -= line - in;
+	memmove(in, line, in_len + 1);
+	if (in_len == sizeof(in) - 1)
+		standby_close();
+}
+
+static void standby_connected_cb(int wfd, short revents, void *arg)
+{
+	char buf[64];
+	socklen_t len = sizeof(int);
+	int err = 0, n;
+
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	if (err) {
+		standby_close();
+		return;
+	}
+
+	/* Catch up from where we were, the primary sends a snapshot if it can't */
+	if (epoch)
+		n = snprintf(buf, sizeof(buf), "subscribe %llx %llu\n", epoch, seq);
+	else
+		n = snprintf(buf, sizeof(buf), "subscribe\n");
+	if (send(fd, buf, n, MSG_DONTWAIT | MSG_NOSIGNAL) != n) {
+		standby_close();
+		return;
+	}
+
+	coord_loop_del(fd);
+	coord_loop_add(fd, POLLIN, standby_read_cb, NULL);
+	log_msg(1, "standby: following %s\n", primary_name);
+}
+
+static void standby_connect(void)
+{
+	fd = socket(primary.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	if (connect(fd, (struct sockaddr *)&primary, primary_len) < 0 &&
+	    errno != EINPROGRESS) {
+		close(fd);
+		fd = -1;
+		return;
+	}
+
+	state = STANDBY_CONNECTING;
+	coord_loop_add(fd, POLLOUT, standby_connected_cb, NULL);
+}
+
+static void standby_check(void *arg)
+{
+	/* Never synced: we know nothing the PAN could rely on */
+	if (epoch && coord_now_ns() - last_heard > STANDBY_FAILOVER_MS * 1000000ULL) {
+		log_msg(0, "standby: nothing from %s for %u ms, taking over\n",
+				primary_name, STANDBY_FAILOVER_MS);
+		standby_close();
+		staged_clear();
+		state = STANDBY_PROMOTED;
+		coord_standby_promote();
+		return;
+	}
+
+	if (fd < 0)
+		standby_connect();
+	coord_timer_add(&timer, STANDBY_RETRY_MS);
+}
+
+/* primary is a control socket path, or host:port of a primary's -P */
+int coord_standby_start(const char *name)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)&primary;
+	int err;
+
+	primary_name = name;
+	if (strchr(name, '/')) {
+		if (strlen(name) >= sizeof(sun->sun_path))
+			return -ENAMETOOLONG;
+		memset(sun, 0, sizeof(*sun));
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, name);
+		primary_len = sizeof(*sun);
+	} else {
+		err = coord_ctl_resolve(name, 0, &primary, &primary_len);
+		if (err < 0)
+			return err;
+	}
+
+	staged = shash_new(hw_hash, hw_eq);
+	if (!staged)
+		return -ENOMEM;
+
+	standby_connect();
+	timer.cb = standby_check;
+	coord_timer_add(&timer, STANDBY_RETRY_MS);
+
+	return 0;
+}
+
+static int standby_cmd(struct coord_ctl_client *c, int argc, char **argv)
+{
+	if (!primary_name)
+		return coord_ctl_error(c, "not a standby");
+
+	coord_ctl_printf(c, "primary %s\n", primary_name);
+	coord_ctl_printf(c, "state %s\n", state_name[state]);
+	coord_ctl_printf(c, "epoch %llx\n", epoch);
+	coord_ctl_printf(c, "seq %llu\n", seq);
+	if (epoch && state != STANDBY_PROMOTED)
+		coord_ctl_printf(c, "heard %llu ms ago\n",
+				(unsigned long long)(coord_now_ns() - last_heard) / 1000000);
+
+	return 0;
+}
+
+const struct coord_ctl_module coord_standby_ctl = {
+	.name = "standby",
+	.commands = {
+	{
+		.name	= "standby",
+		.usage	= "",
+		.call	= standby_cmd,
+	},
+	{}}
+};
@@ -0,0 +1,84 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Binary event trace ring for izcoordinator.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "coordinator.h"
+
+struct coord_trace_hdr *coord_trace_buf;
+static size_t trace_size;
+
+/*
+ * The ring is a shared mapping of the file, so the page cache keeps
+ * the records even if we crash.
+ */
+int coord_trace_open(const char *path)
+{
+	struct coord_trace_hdr *hdr;
+	struct timespec mono, real;
+	int fd, err;
+
+	trace_size = sizeof(*hdr) + COORD_TRACE_RECORDS * sizeof(struct coord_trace_rec);
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, 0) || ftruncate(fd, trace_size)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	hdr = mmap(NULL, trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return -errno;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+
+	memcpy(hdr->magic, COORD_TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->nrec = COORD_TRACE_RECORDS;
+	hdr->rec_size = sizeof(struct coord_trace_rec);
+	hdr->realtime_offset = (real.tv_sec - mono.tv_sec) * 1000000000LL +
+		(real.tv_nsec - mono.tv_nsec);
+	hdr->head = 0;
+
+	coord_trace_buf = hdr;
+
+	return 0;
+}
+
+void coord_trace_close(void)
+{
+	struct coord_trace_hdr *hdr = coord_trace_buf;
+
+	if (!hdr)
+		return;
+
+	coord_trace_buf = NULL;
+	msync(hdr, trace_size, MS_ASYNC);
+	munmap(hdr, trace_size);
+}
@@ -0,0 +1,84 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * On-disk format of the izcoordinator event trace, shared between the
+ * coordinator and the iztrace decoder.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef COORD_TRACE_H
+#define COORD_TRACE_H
+
+#include <stdint.h>
+
+#define COORD_TRACE_MAGIC	"IZTRACE1"
+#define COORD_TRACE_RECORDS	65536	/* power of two */
+
+enum coord_trace_event {
+	TRACE_NONE,
+	TRACE_NL_RECV,		/* arg: genl command */
+	TRACE_NL_SEND,		/* arg: genl command, arg2: error */
+	TRACE_ASSOC_INDIC,	/* arg: capability */
+	TRACE_ASSOC_RESP,	/* short: address, arg: status */
+	TRACE_DISASSOC_INDIC,	/* arg: reason */
+	TRACE_RATELIMIT,	/* request dropped */
+	TRACE_ALLOC,		/* short: result of addrdb_alloc */
+	TRACE_LEASE_ADD,
+	TRACE_LEASE_REFRESH,
+	TRACE_LEASE_DEL,
+	TRACE_FLUSH_START,
+	TRACE_FLUSH_END,	/* arg: duration in us, arg2: error */
+	TRACE_START_REQ,
+	TRACE_START_CONF,	/* arg: status */
+	TRACE_ORPHAN_INDIC,
+	TRACE_ORPHAN_RESP,	/* short: address, arg2: error */
+	TRACE_COMM_STATUS,	/* arg: status */
+	TRACE_ASSOC_ROLLBACK,	/* arg: status */
+	TRACE_ASSOC_DUP,	/* retry dropped */
+	TRACE_ACL_DENY,
+	TRACE_LINK,		/* arg: 1 up, 0 down, arg2: ifindex */
+	TRACE_GTS,		/* arg: characteristics, arg2: status or start */
+	TRACE_INDIRECT_SEND,	/* arg: frames left, arg2: error */
+	TRACE_INDIRECT_EXPIRE,	/* arg: frames left, arg2: 1 if the lease is gone */
+	TRACE_INDIRECT_OVERFLOW,	/* arg: frames queued for the device */
+	__TRACE_MAX,
+};
+
+/*
+ * The record's seq is written last: a reader only trusts a record whose
+ * seq matches the slot it expects, which filters out slots that were
+ * overwritten or only half written when the process died.
+ */
+struct coord_trace_rec {
+	uint64_t ts;		/* CLOCK_MONOTONIC, ns */
+	uint8_t hwaddr[8];
+	uint32_t arg;
+	uint32_t arg2;
+	uint16_t event;
+	uint16_t short_addr;
+	uint32_t seq;		/* low 32 bits of (index + 1) */
+};
+
+struct coord_trace_hdr {
+	char magic[8];
+	uint32_t nrec;
+	uint32_t rec_size;
+	/* CLOCK_REALTIME - CLOCK_MONOTONIC when the trace was opened, ns */
+	int64_t realtime_offset;
+	uint64_t head __attribute__((aligned(64)));
+	struct coord_trace_rec rec[] __attribute__((aligned(64)));
+};
+
+#endif
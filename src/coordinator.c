@@ -27,6 +27,9 @@
 #include <grp.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/signalfd.h>
 
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
@@ -44,20 +47,37 @@
 #include <libgen.h>
 
 #include <logging.h>
+#include <probes.h>
 
 #include "addrdb.h"
-
-#define IEEE802154_SUCCESS 0x0
+#include "coordinator.h"
 
 #define PID_BUF_LEN 32
 
-static int seq_expected;
 static int family;
-static struct nl_sock *nl;
+static const struct coord_transport *transport = &coord_netlink_transport;
+static char *transport_arg;
 static const char *iface;
+/* What the PAN is started with, again after the interface was down */
+static uint16_t pan_id, pan_short;
+static uint8_t pan_channel;
 static char *lease_file;
 static char *pid_file;
-static int die_flag = 0;
+static char *ctl_socket;
+static char *log_target;
+static char *trace_file;
+static char *config_file;
+/* What the command line asked for, and what is in effect now */
+static struct coord_config cmdline_cfg, cur_cfg;
+static volatile sig_atomic_t die_flag = 0;
+/* Ends the standby loop: on promotion, and like die_flag on signals */
+static volatile sig_atomic_t standby_flag;
+/* Our sockets now belong to a newer instance */
+static int handed_off;
+/* When the indication currently being handled was received */
+static uint64_t indic_stamp;
+/* Longest acceptable ASSOCIATE_INDIC to ASSOCIATE_RESP time, 0: none */
+static uint64_t resp_budget_ns;
 
 
 extern int yydebug;
@@ -67,11 +87,23 @@ static void cleanup(int ret);
 static void log_msg_nl_perror(char *s, int err)
 {
 	if (err != NLE_SUCCESS) {
+		coord_count(COORD_CNT_NL_ERROR);
 		log_msg(0, "%s: %s", s, nl_geterror(err));
 		cleanup(1);
 	}
 }
 
+/* Every request to the MAC goes through here, so the trace sees it */
+static int transport_send(struct nl_msg *msg)
+{
+	int cmd = genlmsg_hdr(nlmsg_hdr(msg))->cmd;
+	int err = transport->send(msg);
+
+	coord_trace(TRACE_NL_SEND, NULL, 0, cmd, err);
+
+	return err;
+}
+
 static int mlme_start(uint16_t short_addr, uint16_t pan, uint8_t channel, uint8_t is_coordinator, const char * iface)
 {
 	struct nl_msg *msg = nlmsg_alloc();
@@ -82,18 +114,14 @@ static int mlme_start(uint16_t short_addr, uint16_t pan, uint8_t channel, uint8_
 	nla_put_u16(msg, IEEE802154_ATTR_COORD_SHORT_ADDR, short_addr);
 	nla_put_u8(msg, IEEE802154_ATTR_CHANNEL, channel);
 	nla_put_u8(msg, IEEE802154_ATTR_PAN_COORD, is_coordinator);
-#if 0
-	nla_put_u8(msg, IEEE802154_ATTR_BCN_ORD, bcn_ord);
-	nla_put_u8(msg, IEEE802154_ATTR_SF_ORD, sf_ord);
-	nla_put_u8(msg, IEEE802154_ATTR_BAT_EXT, battery_ext);
-	nla_put_u8(msg, IEEE802154_ATTR_COORD_REALIGN, coord_realign);
-#else
-	nla_put_u8(msg, IEEE802154_ATTR_BCN_ORD, 15);
-	nla_put_u8(msg, IEEE802154_ATTR_SF_ORD, 15);
+	/* 15, 15 unless beacons were asked for with -B */
+	nla_put_u8(msg, IEEE802154_ATTR_BCN_ORD, cur_cfg.bcn_ord);
+	nla_put_u8(msg, IEEE802154_ATTR_SF_ORD, cur_cfg.sf_ord);
 	nla_put_u8(msg, IEEE802154_ATTR_BAT_EXT, 0);
 	nla_put_u8(msg, IEEE802154_ATTR_COORD_REALIGN, 0);
-#endif
-	int err = nl_send_auto_complete(nl, msg);
+	int err = transport_send(msg);
+	nlmsg_free(msg);
+	coord_trace(TRACE_START_REQ, NULL, short_addr, channel, err);
 	if (err < 0)
 		log_msg_nl_perror("nl_send_auto_complete", err);
 	return 0;
@@ -102,6 +130,7 @@ static int mlme_start(uint16_t short_addr, uint16_t pan, uint8_t channel, uint8_
 static int coordinator_associate(struct genlmsghdr *ghdr, struct nlattr **attrs)
 {
 	log_msg(0, "Associate requested\n");
+	coord_count_at(COORD_CNT_ASSOC, indic_stamp);
 
 	if (!attrs[IEEE802154_ATTR_DEV_INDEX] ||
 	    !attrs[IEEE802154_ATTR_SRC_HW_ADDR] ||
@@ -110,28 +139,158 @@ static int coordinator_associate(struct genlmsghdr *ghdr, struct nlattr **attrs)
 
 	// FIXME: checks!!!
 
-	struct nl_msg *msg = nlmsg_alloc();
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	nla_memcpy(hwa, attrs[IEEE802154_ATTR_SRC_HW_ADDR], IEEE802154_ADDR_LEN);
 	uint8_t cap = nla_get_u8(attrs[IEEE802154_ATTR_CAPABILITY]);
+
+	coord_trace(TRACE_ASSOC_INDIC, hwa, 0, cap, 0);
+	PROBE2(izcoordinator, assoc__indic,
+			nla_get_u64(attrs[IEEE802154_ATTR_SRC_HW_ADDR]), cap);
+
+	/* Our response is still on its way; checked first, so retries cost no tokens */
+	if (coord_pending_duplicate(hwa, indic_stamp)) {
+		coord_count(COORD_CNT_ASSOC_DUP);
+		coord_trace(TRACE_ASSOC_DUP, hwa, 0, 0, 0);
+		return 0;
+	}
+
+	/* Stay silent: the device backs off and retries later */
+	if (!coord_ratelimit_admit(hwa, indic_stamp)) {
+		coord_trace(TRACE_RATELIMIT, hwa, 0, 0, 0);
+		return 0;
+	}
+
+	struct nl_msg *msg = nlmsg_alloc();
 	uint16_t shaddr = 0xfffe;
+	uint8_t status = 0x00;
+	int admit = coord_acl_admit(hwa);
 
 	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, NLM_F_REQUEST, IEEE802154_ASSOCIATE_RESP, /* vers */ 1);
 
-	if (cap & (1 << 7)) { /* FIXME: constant */
-		uint8_t hwa[IEEE802154_ADDR_LEN];
-		nla_memcpy(hwa, attrs[IEEE802154_ATTR_SRC_HW_ADDR], IEEE802154_ADDR_LEN);
-		shaddr = addrdb_alloc(hwa);
-		addrdb_dump_leases(lease_file);
+	if (!admit) {
+		/* PAN access denied, so the device stops trying */
+		coord_count(COORD_CNT_ACL_DENIED);
+		coord_trace(TRACE_ACL_DENY, hwa, 0, 0, 0);
+		shaddr = 0xffff;
+		status = 0x02;
+	} else if (cap & (1 << 7)) { /* FIXME: constant */
+		/* Dropped if COMM_STATUS says the device missed it; FFDs may route */
+		shaddr = addrdb_alloc_pending(hwa, cap & (1 << 1));
+		coord_trace(TRACE_ALLOC, hwa, shaddr, 0, 0);
+		if (shaddr == 0xffff)
+			status = 0x01;	/* PAN at capacity */
 	}
 
 	nla_put_u32(msg, IEEE802154_ATTR_DEV_INDEX, nla_get_u32(attrs[IEEE802154_ATTR_DEV_INDEX]));
-	nla_put_u8(msg, IEEE802154_ATTR_STATUS, (shaddr != 0xffff) ? 0x0: 0x01);
+	nla_put_u8(msg, IEEE802154_ATTR_STATUS, status);
 	nla_put_u64(msg, IEEE802154_ATTR_DEST_HW_ADDR, nla_get_u64(attrs[IEEE802154_ATTR_SRC_HW_ADDR]));
 	nla_put_u16(msg, IEEE802154_ATTR_DEST_SHORT_ADDR, shaddr);
 
-	int err = nl_send_auto_complete(nl, msg);
+	int err = transport_send(msg);
+	nlmsg_free(msg);
+	coord_trace(TRACE_ASSOC_RESP, hwa, shaddr, status, err);
+	PROBE4(izcoordinator, assoc__resp,
+			nla_get_u64(attrs[IEEE802154_ATTR_SRC_HW_ADDR]), shaddr, status, err);
+
+	if (err < 0) {
+		/* The device will retry, no reason to give up the PAN */
+		coord_count(COORD_CNT_NL_ERROR);
+		log_msg(0, "Can't send ASSOCIATE_RESP: %s\n", nl_geterror(err));
+		addrdb_release(hwa);
+	} else {
+		if (shaddr < 0xfffe && coord_pending_add(hwa) < 0)
+			addrdb_commit(hwa);
 
-	if (err < 0)
-		log_msg_nl_perror("nl_send_auto_complete", err);
+		uint64_t lat = coord_now_ns() - indic_stamp;
+
+		coord_observe(COORD_HIST_ASSOC_LATENCY, lat);
+		if (resp_budget_ns && lat > resp_budget_ns) {
+			coord_count(COORD_CNT_DEADLINE_MISS);
+			log_msg(0, "ASSOCIATE_RESP after %llu us, budget is %llu us\n",
+					(unsigned long long)lat / 1000,
+					(unsigned long long)resp_budget_ns / 1000);
+		}
+	}
+
+	if (status == 0x01)
+		coord_count(COORD_CNT_ALLOC_FAIL);
+
+	return 0;
+}
+
+/*
+ * A device that lost sync but still holds a lease gets its old short
+ * address back right away instead of going through association again.
+ * Unknown devices are ignored, they will associate after the scan.
+ */
+static int coordinator_orphan(struct genlmsghdr *ghdr, struct nlattr **attrs)
+{
+	log_msg(0, "Orphan notification\n");
+	coord_count(COORD_CNT_ORPHAN);
+
+	if (!attrs[IEEE802154_ATTR_DEV_INDEX] ||
+	    !attrs[IEEE802154_ATTR_SRC_HW_ADDR])
+		return -EINVAL;
+
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	nla_memcpy(hwa, attrs[IEEE802154_ATTR_SRC_HW_ADDR], IEEE802154_ADDR_LEN);
+
+	coord_trace(TRACE_ORPHAN_INDIC, hwa, 0, 0, 0);
+
+	if (!coord_ratelimit_admit(hwa, indic_stamp)) {
+		coord_trace(TRACE_RATELIMIT, hwa, 0, 0, 0);
+		return 0;
+	}
+
+	if (!coord_acl_admit(hwa)) {
+		coord_count(COORD_CNT_ACL_DENIED);
+		coord_trace(TRACE_ACL_DENY, hwa, 0, 0, 0);
+		return 0;
+	}
+
+	uint16_t shaddr = addrdb_lookup_hw(hwa);
+	if (shaddr == 0xffff) {
+		coord_count(COORD_CNT_ORPHAN_UNKNOWN);
+		return 0;
+	}
+
+	struct nl_msg *msg = nlmsg_alloc();
+
+	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, NLM_F_REQUEST, IEEE802154_ORPHAN_RESP, /* vers */ 1);
+
+	nla_put_u32(msg, IEEE802154_ATTR_DEV_INDEX, nla_get_u32(attrs[IEEE802154_ATTR_DEV_INDEX]));
+	nla_put_u64(msg, IEEE802154_ATTR_DEST_HW_ADDR, nla_get_u64(attrs[IEEE802154_ATTR_SRC_HW_ADDR]));
+	nla_put_u16(msg, IEEE802154_ATTR_DEST_SHORT_ADDR, shaddr);
+	/* Associated member: the MAC sends a coordinator realignment */
+	nla_put_u8(msg, IEEE802154_ATTR_COORD_REALIGN, 1);
+
+	int err = transport_send(msg);
+	nlmsg_free(msg);
+	coord_trace(TRACE_ORPHAN_RESP, hwa, shaddr, 0, err);
+
+	if (err < 0) {
+		coord_count(COORD_CNT_NL_ERROR);
+		log_msg(0, "Can't send ORPHAN_RESP: %s\n", nl_geterror(err));
+	}
+
+	return 0;
+}
+
+/* The MAC's verdict on an ASSOCIATE_RESP we sent */
+static int coordinator_comm_status(struct genlmsghdr *ghdr, struct nlattr **attrs)
+{
+	log_msg(0, "Communication status\n");
+
+	if (!attrs[IEEE802154_ATTR_STATUS] ||
+	    !attrs[IEEE802154_ATTR_DEST_HW_ADDR])
+		return -EINVAL;
+
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+	nla_memcpy(hwa, attrs[IEEE802154_ATTR_DEST_HW_ADDR], IEEE802154_ADDR_LEN);
+	uint8_t status = nla_get_u8(attrs[IEEE802154_ATTR_STATUS]);
+
+	coord_trace(TRACE_COMM_STATUS, hwa, 0, status, 0);
+	coord_pending_status(hwa, status);
 
 	return 0;
 }
@@ -139,26 +298,95 @@ static int coordinator_associate(struct genlmsghdr *ghdr, struct nlattr **attrs)
 static int coordinator_disassociate(struct genlmsghdr *ghdr, struct nlattr **attrs)
 {
 	log_msg(0, "Disassociate requested\n");
+	coord_count_at(COORD_CNT_DISASSOC, indic_stamp);
 
 	if (!attrs[IEEE802154_ATTR_DEV_INDEX] ||
 	    !attrs[IEEE802154_ATTR_REASON] ||
 	    (!attrs[IEEE802154_ATTR_SRC_HW_ADDR] && !attrs[IEEE802154_ATTR_SRC_SHORT_ADDR]))
 		return -EINVAL;
 
+	uint8_t reason = nla_get_u8(attrs[IEEE802154_ATTR_REASON]);
+
 	// FIXME: checks!!!
 	if (attrs[IEEE802154_ATTR_SRC_HW_ADDR]) {
 		uint8_t hwa[IEEE802154_ADDR_LEN];
 		nla_memcpy(hwa, attrs[IEEE802154_ATTR_SRC_HW_ADDR], IEEE802154_ADDR_LEN);
+		coord_trace(TRACE_DISASSOC_INDIC, hwa, 0xffff, reason, 0);
 		addrdb_free_hw(hwa);
 	} else {
 		uint16_t short_addr = nla_get_u16(attrs[IEEE802154_ATTR_SRC_SHORT_ADDR]);
+		coord_trace(TRACE_DISASSOC_INDIC, NULL, short_addr, reason, 0);
 		addrdb_free_short(short_addr);
 	}
-	addrdb_dump_leases(lease_file);
 
 	return 0;
 }
 
+/* A device asks for a GTS or gives one back */
+static int coordinator_gts(struct genlmsghdr *ghdr, struct nlattr **attrs)
+{
+	log_msg(0, "GTS requested\n");
+
+	if (!attrs[IEEE802154_ATTR_SRC_SHORT_ADDR] ||
+	    !attrs[IEEE802154_ATTR_CAPABILITY])
+		return -EINVAL;
+
+	coord_gts_request(nla_get_u16(attrs[IEEE802154_ATTR_SRC_SHORT_ADDR]),
+			nla_get_u8(attrs[IEEE802154_ATTR_CAPABILITY]));
+
+	return 0;
+}
+
+void coord_gts_notify(uint16_t short_addr, uint8_t characteristics,
+		uint8_t start, uint8_t status)
+{
+	struct nl_msg *msg = nlmsg_alloc();
+	int err;
+
+	if (!msg)
+		return;
+
+	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, NLM_F_REQUEST, IEEE802154_GTS_CONF, /* vers */ 1);
+	nla_put_string(msg, IEEE802154_ATTR_DEV_NAME, iface);
+	nla_put_u16(msg, IEEE802154_ATTR_DEST_SHORT_ADDR, short_addr);
+	nla_put_u8(msg, IEEE802154_ATTR_CAPABILITY, characteristics);
+	nla_put_u8(msg, IEEE802154_ATTR_DURATION, start);
+	nla_put_u8(msg, IEEE802154_ATTR_STATUS, status);
+
+	err = transport_send(msg);
+	nlmsg_free(msg);
+
+	if (err < 0) {
+		coord_count(COORD_CNT_NL_ERROR);
+		log_msg(0, "Can't send GTS_CONF: %s\n", nl_geterror(err));
+	}
+}
+
+/* A device asks whether we hold data for it */
+static int coordinator_poll(struct genlmsghdr *ghdr, struct nlattr **attrs)
+{
+	uint8_t hwa[IEEE802154_ADDR_LEN];
+
+	if (attrs[IEEE802154_ATTR_SRC_SHORT_ADDR]) {
+		coord_indirect_poll(NULL, nla_get_u16(attrs[IEEE802154_ATTR_SRC_SHORT_ADDR]));
+	} else if (attrs[IEEE802154_ATTR_SRC_HW_ADDR]) {
+		nla_memcpy(hwa, attrs[IEEE802154_ATTR_SRC_HW_ADDR], IEEE802154_ADDR_LEN);
+		coord_indirect_poll(hwa, 0xffff);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int coord_indirect_send(uint16_t short_addr, const void *buf, size_t len)
+{
+	if (!transport->data)
+		return -EOPNOTSUPP;
+
+	return transport->data(pan_id, pan_short, short_addr, buf, len);
+}
+
 static int coordinator_start_confirm(struct genlmsghdr *ghdr, struct nlattr **attrs)
 {
 	log_msg(0, "Start confirmation\n");
@@ -168,6 +396,8 @@ static int coordinator_start_confirm(struct genlmsghdr *ghdr, struct nlattr **at
 
 	uint8_t status = nla_get_u8(attrs[IEEE802154_ATTR_STATUS]);
 
+	coord_trace(TRACE_START_CONF, NULL, 0, status, 0);
+
 	if (status != IEEE802154_SUCCESS) {
 		log_msg(0, "START failed!\n");
 		die_flag = 1;
@@ -176,18 +406,22 @@ static int coordinator_start_confirm(struct genlmsghdr *ghdr, struct nlattr **at
 	return 0;
 }
 
-static int parse_cb(struct nl_msg *msg, void *arg)
+int coord_mlme_input(struct nl_msg *msg)
 {
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
 	struct nlattr *attrs[IEEE802154_ATTR_MAX+1];
         struct genlmsghdr *ghdr;
 	const char *name;
 
+	indic_stamp = coord_now_ns();
+
 	// Validate message and parse attributes
 	genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy);
 
         ghdr = nlmsg_data(nlh);
 
+	coord_trace(TRACE_NL_RECV, NULL, 0, ghdr->cmd, nlh->nlmsg_seq);
+
 	if (!attrs[IEEE802154_ATTR_DEV_NAME])
 		return -EINVAL;
 
@@ -204,6 +438,14 @@ static int parse_cb(struct nl_msg *msg, void *arg)
 			return coordinator_associate(ghdr, attrs);
 		case IEEE802154_DISASSOCIATE_INDIC:
 			return coordinator_disassociate(ghdr, attrs);
+		case IEEE802154_ORPHAN_INDIC:
+			return coordinator_orphan(ghdr, attrs);
+		case IEEE802154_COMM_STATUS_INDIC:
+			return coordinator_comm_status(ghdr, attrs);
+		case IEEE802154_GTS_INDIC:
+			return coordinator_gts(ghdr, attrs);
+		case IEEE802154_POLL_REQ:
+			return coordinator_poll(ghdr, attrs);
 		case IEEE802154_START_CONF:
 			return coordinator_start_confirm(ghdr, attrs);
 	}
@@ -211,52 +453,299 @@ static int parse_cb(struct nl_msg *msg, void *arg)
 	return 0;
 }
 
-static int seq_check(struct nl_msg *msg, void *arg) {
-	if (nlmsg_get_src(msg)->nl_groups)
-		return NL_OK;
+static void lease_notify(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp)
+{
+	static const enum coord_trace_event trace_ev[] = {
+		[ADDRDB_LEASE_ADD] = TRACE_LEASE_ADD,
+		[ADDRDB_LEASE_REFRESH] = TRACE_LEASE_REFRESH,
+		[ADDRDB_LEASE_DEL] = TRACE_LEASE_DEL,
+	};
+
+	coord_trace(trace_ev[ev], hwa, short_addr, stamp, 0);
+	if (ev == ADDRDB_LEASE_DEL)
+		coord_gts_release(short_addr);
+	coord_indirect_lease(ev, hwa, short_addr);
+	coord_persist_lease(ev, hwa, short_addr, stamp);
+	coord_feed_lease(ev, hwa, short_addr, stamp);
+}
 
-	uint32_t seq = nlmsg_hdr(msg)->nlmsg_seq;
+static void dump_lease_handler(int t)
+{
+	coord_persist_flush();
+}
+
+/* The persistence thread writes <path>.tmp and renames it over path */
+static int probe_lease_file(const char *path)
+{
+	char *tmp;
+	int fd, err = 0;
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0)
+		return -ENOMEM;
 
-	if (seq == seq_expected) {
-		seq_expected ++;
-		return NL_OK;
+	fd = open(tmp, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0) {
+		err = -errno;
+	} else {
+		close(fd);
+		unlink(tmp);
 	}
+	free(tmp);
 
-	log_msg(0, "Sequence number mismatch: %x != %x\n", seq, seq_expected);
+	return err;
+}
 
-	return NL_SKIP;
+static int switch_lease_file(const char *path)
+{
+	char old[PATH_MAX];
+	int err;
+
+	err = probe_lease_file(path);
+	if (err < 0) {
+		log_msg(0, "Can't persist leases to %s: %s, keeping %s\n",
+				path, strerror(-err), cur_cfg.lease_file);
+		return err;
+	}
+
+	strcpy(old, cur_cfg.lease_file);
+
+	addrdb_set_notify(NULL);
+	coord_persist_stop();
+
+	strcpy(cur_cfg.lease_file, path);
+	err = coord_persist_start(cur_cfg.lease_file);
+	if (err < 0) {
+		log_msg(0, "Can't persist leases to %s: %s, keeping %s\n",
+				path, strerror(-err), old);
+		strcpy(cur_cfg.lease_file, old);
+		if (coord_persist_start(cur_cfg.lease_file) < 0)
+			log_msg(0, "Lease persistence is off\n");
+	}
+	addrdb_set_notify(lease_notify);
+	/* Write the whole table to the new file at once */
+	coord_persist_flush();
+
+	return err;
 }
 
-static void dump_lease_handler(int t)
+int coord_reload(void)
+{
+	struct coord_config cfg = cmdline_cfg;
+	int err;
+
+	if (!config_file)
+		return -ENOENT;
+
+	err = coord_config_load(config_file, &cfg);
+	if (err < 0)
+		return err;
+
+	/* Routers already hand out addresses from their blocks */
+	if (cfg.tree_cm != cur_cfg.tree_cm || cfg.tree_rm != cur_cfg.tree_rm ||
+	    cfg.tree_lm != cur_cfg.tree_lm ||
+	    (cur_cfg.tree_cm && (cfg.range_min != cur_cfg.range_min ||
+				 cfg.range_max != cur_cfg.range_max))) {
+		log_msg(0, "config: tree layout can't change without a restart\n");
+		return -EINVAL;
+	}
+	if (cfg.bcn_ord != cur_cfg.bcn_ord || cfg.sf_ord != cur_cfg.sf_ord) {
+		log_msg(0, "config: beacon orders can't change without a restart\n");
+		return -EINVAL;
+	}
+
+	if (coord_ratelimit_init(cfg.dev_rate, cfg.dev_burst,
+				cfg.global_rate, cfg.global_burst))
+		return -ENOMEM;
+
+	if (strcmp(cfg.lease_file, cur_cfg.lease_file)) {
+		err = switch_lease_file(cfg.lease_file);
+		if (err < 0) {
+			coord_ratelimit_init(cur_cfg.dev_rate, cur_cfg.dev_burst,
+					cur_cfg.global_rate, cur_cfg.global_burst);
+			return err;
+		}
+	}
+
+	if (cfg.range_min != cur_cfg.range_min || cfg.range_max != cur_cfg.range_max) {
+		unsigned int outside = addrdb_set_range(cfg.range_min, cfg.range_max);
+
+		log_msg(0, "Allocating %04x-%04x now, %u leases to move on rejoin\n",
+				cfg.range_min, cfg.range_max, outside);
+	}
+
+	log_set_level(cfg.debug);
+	yydebug = cfg.debug > 1;
+	resp_budget_ns = (uint64_t)cfg.resp_budget_us * 1000;
+	coord_pending_set_window(cfg.dedup_window_ms);
+
+	/* Lists may be big, the loop goes on with the old ones meanwhile */
+	err = coord_acl_reload(cfg.allow_list, cfg.deny_list);
+	if (err < 0)
+		log_msg(0, "Can't reload admission lists: %s\n", strerror(-err));
+
+	/* lease_file is equal by now, the persistence thread may read it */
+	cur_cfg = cfg;
+	log_msg(0, "Configuration reloaded from %s\n", config_file);
+
+	return 0;
+}
+
+static void sighup_cb(int fd, short revents, void *arg)
+{
+	struct signalfd_siginfo si;
+	int err;
+
+	if (read(fd, &si, sizeof(si)) != sizeof(si))
+		return;
+
+	if (!config_file) {
+		coord_persist_flush();
+		if (cur_cfg.allow_list[0] || cur_cfg.deny_list[0]) {
+			err = coord_acl_reload(cur_cfg.allow_list, cur_cfg.deny_list);
+			if (err < 0)
+				log_msg(0, "Can't reload admission lists: %s\n", strerror(-err));
+		}
+		return;
+	}
+
+	err = coord_reload();
+	if (err < 0)
+		log_msg(0, "Reload failed, configuration unchanged: %s\n", strerror(-err));
+}
+
+static void transport_event_cb(int fd, short revents, void *arg)
+{
+	if (transport->recv() < 0) {
+		log_msg(0, "%s transport closed\n", transport->name);
+		die_flag = 1;
+	}
+}
+
+int coord_handoff_release(struct coord_handoff *h)
+{
+	if (!transport->adopt)
+		return -EOPNOTSUPP;
+
+	/* Whatever arrives from now on is left queued for the successor */
+	coord_loop_del(transport->get_fd());
+	/* Its COMM_STATUS would find nothing pending over there */
+	coord_pending_commit_all();
+	/* Neither would it know our GTSs */
+	coord_gts_release_all();
+	addrdb_set_notify(NULL);
+	coord_persist_stop();
+
+	h->nl_fd = transport->get_fd();
+	h->ctl_fd = coord_ctl_listen_fd();
+	h->family = family;
+	strncpy(h->iface, iface, sizeof(h->iface) - 1);
+	h->iface[sizeof(h->iface) - 1] = '\0';
+
+	return 0;
+}
+
+void coord_handoff_resume(void)
+{
+	int err = coord_persist_start(lease_file);
+
+	if (err < 0)
+		log_msg(0, "Can't restart lease persistence: %s\n", strerror(-err));
+	else
+		addrdb_set_notify(lease_notify);
+	coord_loop_add(transport->get_fd(), POLLIN, transport_event_cb, NULL);
+}
+
+void coord_handoff_done(void)
 {
-	addrdb_dump_leases(lease_file);
+	handed_off = 1;
+	coord_ctl_detach();
+	die_flag = 1;
 }
 
 static void cleanup(int ret)
 {
-	if(ret == 0)
-		addrdb_dump_leases(lease_file);
-	nl_close(nl);
-	unlink(pid_file);
+	coord_ctl_close();
+	/* Flushes whatever is still queued to the lease file */
+	addrdb_set_notify(NULL);
+	coord_persist_stop();
+	coord_trace_close();
+	transport->close();
+	coord_acl_stop();
+	log_stop_async();
+	if (!handed_off)
+		unlink(pid_file);
 	exit(ret);	
 }
 
+void coord_link_up(void)
+{
+	mlme_start(pan_short, pan_id, pan_channel, 1, iface);
+}
+
+void coord_standby_promote(void)
+{
+	standby_flag = 1;
+}
+
 static void exit_handler(int t)
 {
 	die_flag = 1;
-	cleanup(0);
+	standby_flag = 1;
 }
 
 static void usage(char * name)
 {
 	printf("Usage: %s [OPTION]... -i IFACE\n", name);
 	printf("Provide a userspace part of IEEE 802.15.4 coordinator on specified IFACE.\n\n");
-	printf(	" -l lease_file      Where we store lease file.\n"
+	printf(	" -C config_file     Read settings from config_file; read it again\n"
+		"                    on SIGHUP or the reload control command.\n"
+		" -l lease_file      Where we store lease file.\n"
 		" -f pid_file        Where to store process PID.\n"
+		" -S ctl_socket      Where to create the control socket.\n"
+		" -L target          Log asynchronously to syslog, stderr or a file.\n"
+		" -T trace_file      Record a binary event trace (see iztrace).\n"
 		" -d debug_level     Set debug level of application.\n"
 		"                    Will not demonize on levels > 0.\n"
 		" -m range_min       Minimal new 16-bit address allocated.\n"
-		" -n range_max       Maximal new 16-bit address allocated.\n"
+		" -n range_max       Maximal new 16-bit address allocated, fffd at most.\n"
+		" -r rate[:burst]    Limit associations per device and second.\n"
+		" -g rate[:burst]    Limit associations of all devices per second.\n"
+		" -M rate:count[:devices[:loss[:gts[:poll]]]]\n"
+		"                    Talk to a built-in mock instead of the kernel: send\n"
+		"                    count association requests from the given number\n"
+		"                    of devices at rate per second (0: no limit), losing\n"
+		"                    loss percent of the responses, log throughput and\n"
+		"                    latency, then exit. The first gts devices ask for\n"
+		"                    a GTS once associated; the slot map is logged.\n"
+		"                    Odd devices sleep and poll every poll msec.\n"
+		" -R prio[:cpus]     Real-time mode: lock memory, run the netlink thread\n"
+		"                    as SCHED_FIFO prio (0: keep policy), on cpus (1,3-5).\n"
+		" -a allow_file      Only admit devices listed in allow_file.\n"
+		" -b deny_file       Never admit devices listed in deny_file.\n"
+		"                    One EUI-64 per line, as in the lease file; both\n"
+		"                    are read again on SIGHUP.\n"
+		" -t cm:rm:lm        Tree mode: up to cm children, rm of them routers,\n"
+		"                    lm levels deep. Routers get a block of addresses\n"
+		"                    for their own children, end devices one address.\n"
+		" -B bo:so           Send beacons with beacon order bo and superframe\n"
+		"                    order so, and give out guaranteed time slots.\n"
+		" -Q frames[:per_device[:persistence]]\n"
+		"                    Hold up to frames frames, per_device of them for\n"
+		"                    one device, until devices poll for them; drop them\n"
+		"                    after persistence unit periods (default 256:4:500).\n"
+		" -w usec            Count associations answered later than usec.\n"
+		" -W msec            Drop association retries that come within msec\n"
+		"                    of our response to the device (default: off).\n"
+		" -P [host:]port     Serve the lease feed to standbys over TCP, on\n"
+		"                    127.0.0.1 unless host is given; '*' is every\n"
+		"                    address. The lease queries and the feed are\n"
+		"                    readable by anyone who can reach the port.\n"
+		" -F primary         Run as hot standby of the primary at host:port,\n"
+		"                    or on its control socket path: keep its leases\n"
+		"                    and take over the PAN once it goes silent.\n"
+		" -H                 Take over from the instance running on ctl_socket:\n"
+		"                    its sockets and leases, without restarting the PAN.\n"
 		" -i iface           Interface to work with.\n"
 		" -s addr            16-bit address of coordinator (hexadecimal).\n"
 		" -p addr            16-bit PAN ID (hexadecimal).\n"
@@ -282,14 +771,27 @@ static int range_min, range_max;
 int main(int argc, char **argv)
 {
 	struct sigaction sa;
-	int opt, debug, pid_fd, uid;
+	int opt, debug, pid_fd, uid, i;
 	uint16_t pan = 0xffff, short_addr = 0xffff;
 	char pname[PATH_MAX];
 	uint8_t channel = 0;
+	unsigned int dev_rate = 0, dev_burst = 0, global_rate = 0, global_burst = 0;
+	int rt_mode = 0, rt_prio = 0;
+	int takeover = 0;
+	int err;
+	struct coord_handoff handoff;
+	unsigned long resp_budget_us = 0;
+	unsigned int dedup_window_ms = 0;
+	unsigned int indirect_frames = 256, indirect_per_dev = 4, indirect_persistence = 500;
+	const char *allow_list = "", *deny_list = "";
+	const char *standby_listen = NULL, *primary = NULL;
+	sigset_t hup;
+	int hup_fd;
 
 	debug = 0;
 	range_min = 0x8000;
 	range_max = 0xfffd;
+	cmdline_cfg.bcn_ord = cmdline_cfg.sf_ord = 15;
 
 
 	lease_file = getenv("LEASE_FILE");
@@ -302,25 +804,41 @@ int main(int argc, char **argv)
 	if (!pid_file)
 		pid_file = PID_FILE;
 
+	ctl_socket = getenv("CTL_SOCKET");
+	if (!ctl_socket)
+		ctl_socket = CTL_SOCKET;
+
 	while(1) {
 #ifdef HAVE_GETOPT_LONG
 		int option_index = 0;
-		opt = getopt_long(argc, argv, "l:f:d:m:n:i:s:p:c:hv",
+		opt = getopt_long(argc, argv, "C:l:f:S:L:T:d:m:n:r:g:a:b:M:R:t:B:Q:w:W:P:F:Hi:s:p:c:hv",
 				long_options, &option_index);
 #else
-		opt = getopt(argc, argv, "l:f:d:m:n:i:s:p:c:hv");
+		opt = getopt(argc, argv, "C:l:f:S:L:T:d:m:n:r:g:a:b:M:R:t:B:Q:w:W:P:F:Hi:s:p:c:hv");
 #endif
 		fprintf(stderr, "Opt: %c (%hhx)\n", opt, opt);
 		if (opt == -1)
 			break;
 
 		switch(opt) {
+		case 'C':
+			config_file = optarg;
+			break;
 		case 'l':
 			lease_file = optarg;
 			break;
 		case 'f':
 			pid_file = optarg;
 			break;
+		case 'S':
+			ctl_socket = optarg;
+			break;
+		case 'L':
+			log_target = optarg;
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
 		case 'd':
 			debug = atoi(optarg);
 			break;
@@ -330,6 +848,75 @@ int main(int argc, char **argv)
 		case 'n':
 			range_max = strtol(optarg, NULL, 16);
 			break;
+		case 'r':
+			if (coord_ratelimit_parse(optarg, &dev_rate, &dev_burst)) {
+				fprintf(stderr, "Bad rate limit: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'g':
+			if (coord_ratelimit_parse(optarg, &global_rate, &global_burst)) {
+				fprintf(stderr, "Bad rate limit: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'M':
+			transport = &coord_mock_transport;
+			transport_arg = optarg;
+			break;
+		case 'R': {
+			char *end;
+
+			rt_prio = strtol(optarg, &end, 0);
+			if (rt_prio < 0 || rt_prio > sched_get_priority_max(SCHED_FIFO) ||
+			    (*end == ':' && coord_rt_parse_cpus(end + 1)) ||
+			    (*end && *end != ':')) {
+				fprintf(stderr, "Bad real-time setting: %s\n", optarg);
+				return -1;
+			}
+			rt_mode = 1;
+			break;
+		}
+		case 't':
+			if (coord_config_parse_tree(optarg, &cmdline_cfg)) {
+				fprintf(stderr, "Bad tree layout: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'B':
+			if (coord_config_parse_beacon(optarg, &cmdline_cfg)) {
+				fprintf(stderr, "Bad beacon orders: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'Q':
+			if (coord_indirect_parse(optarg, &indirect_frames,
+						&indirect_per_dev, &indirect_persistence)) {
+				fprintf(stderr, "Bad indirect queue setting: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'w':
+			resp_budget_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			allow_list = optarg;
+			break;
+		case 'b':
+			deny_list = optarg;
+			break;
+		case 'W':
+			dedup_window_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			standby_listen = optarg;
+			break;
+		case 'F':
+			primary = optarg;
+			break;
+		case 'H':
+			takeover = 1;
+			break;
 		case 'i':
 			iface = strdup(optarg);
 			break;
@@ -361,12 +948,53 @@ int main(int argc, char **argv)
 			return -1;
 		}
 	}
+	if (takeover && primary) {
+		fprintf(stderr, "A standby has nothing to take over\n");
+		return -1;
+	}
 	if (pan == 0 || short_addr == 0) {
 		fprintf(stderr, "PAN address and/or 16-bit address were not set\n");
 		usage(pname);
 		return -1;
 	}
-	lease_file[sizeof(lease_file)-1] = '\0';
+
+	if (strlen(lease_file) >= sizeof(cmdline_cfg.lease_file) ||
+	    strlen(allow_list) >= sizeof(cmdline_cfg.allow_list) ||
+	    strlen(deny_list) >= sizeof(cmdline_cfg.deny_list)) {
+		fprintf(stderr, "File name too long\n");
+		return -1;
+	}
+	if (range_max > ADDRDB_SHORT_MAX)
+		range_max = ADDRDB_SHORT_MAX;
+	if (range_min < 0 || range_min > range_max) {
+		fprintf(stderr, "Bad address range %04x-%04x\n", range_min, range_max);
+		return -1;
+	}
+	cmdline_cfg.range_min = range_min;
+	cmdline_cfg.range_max = range_max;
+	cmdline_cfg.debug = debug;
+	strcpy(cmdline_cfg.lease_file, lease_file);
+	cmdline_cfg.dev_rate = dev_rate;
+	cmdline_cfg.dev_burst = dev_burst;
+	cmdline_cfg.global_rate = global_rate;
+	cmdline_cfg.global_burst = global_burst;
+	cmdline_cfg.resp_budget_us = resp_budget_us;
+	cmdline_cfg.dedup_window_ms = dedup_window_ms;
+	strcpy(cmdline_cfg.allow_list, allow_list);
+	strcpy(cmdline_cfg.deny_list, deny_list);
+
+	cur_cfg = cmdline_cfg;
+	if (config_file && coord_config_load(config_file, &cur_cfg) < 0) {
+		fprintf(stderr, "Bad configuration file %s\n", config_file);
+		return -1;
+	}
+	range_min = cur_cfg.range_min;
+	range_max = cur_cfg.range_max;
+	debug = cur_cfg.debug;
+	lease_file = cur_cfg.lease_file;
+	resp_budget_ns = (uint64_t)cur_cfg.resp_budget_us * 1000;
+	coord_pending_set_window(cur_cfg.dedup_window_ms);
+
 	if (debug > 1)
 		yydebug = 1; /* Parser debug */
 	else
@@ -374,20 +1002,60 @@ int main(int argc, char **argv)
 
 	init_log(basename(argv[0]), debug);
 
+	coord_gts_init(cur_cfg.bcn_ord, cur_cfg.sf_ord);
+	addrdb_init(range_min, range_max);
+	if (addrdb_set_tree(cur_cfg.tree_cm, cur_cfg.tree_rm, cur_cfg.tree_lm)) {
+		fprintf(stderr, "Tree of %u:%u:%u does not fit into %04x-%04x\n",
+				cur_cfg.tree_cm, cur_cfg.tree_rm, cur_cfg.tree_lm,
+				range_min, range_max);
+		return -1;
+	}
+
+	/* Before a takeover, which stops the old instance from serving */
+	err = coord_acl_load(cur_cfg.allow_list, cur_cfg.deny_list);
+	if (err < 0) {
+		fprintf(stderr, "Can't load admission lists: %s\n", strerror(-err));
+		return 1;
+	}
+
+	if (takeover) {
+		/* The running instance stops serving as soon as this returns */
+		int err = coord_handoff_receive(ctl_socket, &handoff);
+
+		if (err < 0) {
+			fprintf(stderr, "Takeover from %s failed: %s\n", ctl_socket, strerror(-err));
+			return 1;
+		}
+		if (iface && strcmp(iface, handoff.iface))
+			log_msg(0, "Serving %s as before, not %s\n", handoff.iface, iface);
+		iface = strdup(handoff.iface);
+	} else {
+		addrdb_parse(lease_file);
+	}
+
 	if (!iface) {
 		usage(pname);
 		return -1;
 	}
 
-	addrdb_init(range_min, range_max);
-	addrdb_parse(lease_file);
+	if (coord_ratelimit_init(cur_cfg.dev_rate, cur_cfg.dev_burst,
+				cur_cfg.global_rate, cur_cfg.global_burst) ||
+	    coord_pending_init() ||
+	    coord_indirect_init(indirect_frames, indirect_per_dev,
+				indirect_persistence, channel, cur_cfg.bcn_ord)) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
 
 	sa.sa_handler = dump_lease_handler;
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
 	sigaction(SIGUSR1, &sa, NULL);
-	sa.sa_handler = dump_lease_handler;
-	sigaction(SIGHUP, &sa, NULL);
+
+	/* Read from the loop, so a reload never races the netlink thread */
+	sigemptyset(&hup);
+	sigaddset(&hup, SIGHUP);
+	sigprocmask(SIG_BLOCK, &hup, NULL);
 
 	sa.sa_handler = exit_handler;
 	sigaction(SIGTERM, &sa, NULL);
@@ -398,27 +1066,7 @@ int main(int argc, char **argv)
 	sa.sa_handler = SIG_IGN;
 	sigaction(SIGPIPE, &sa, NULL);
 
-	int err = NLE_SUCCESS;
-	nl = nl_socket_alloc();
-
-	if (!nl) {
-		log_msg_nl_perror("nl_sock_alloc", NLE_NOMEM);
-		return 1;
-	}
-
-	err = genl_connect(nl);
-	log_msg_nl_perror("genl_connect", err);
-
-	family = genl_ctrl_resolve(nl, IEEE802154_NL_NAME);
-	if (family < 0)
-		log_msg_nl_perror("genl_ctrl_resolve", family);
-
-	nl_socket_add_membership(nl, nl_get_multicast_id(nl, IEEE802154_NL_NAME, IEEE802154_MCAST_COORD_NAME));
-
-	seq_expected = nl_socket_use_seq(nl) + 1;
-
-	nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM, parse_cb, NULL);
-	nl_socket_modify_cb(nl, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	err = NLE_SUCCESS;
 
 #if 0
 	if(debug == 0) {
@@ -469,12 +1117,105 @@ int main(int argc, char **argv)
 
 		close (pid_fd);
 	}
-	mlme_start(short_addr, pan, channel, 1, iface);
 
-	while (!die_flag) {
-		err = nl_recvmsgs_default(nl);
-		log_msg_nl_perror("nl_recvmsgs", err);
+	/* After daemon(): the helper threads would not survive the fork */
+	if (log_target) {
+		if (!strcmp(log_target, "syslog"))
+			err = log_start_async(LOG_TARGET_SYSLOG, NULL);
+		else if (!strcmp(log_target, "stderr"))
+			err = log_start_async(LOG_TARGET_STDERR, NULL);
+		else
+			err = log_start_async(LOG_TARGET_FILE, log_target);
+		if (err < 0)
+			log_msg(0, "Can't start logging to %s: %s\n", log_target, strerror(-err));
+	}
+
+	if (trace_file) {
+		err = coord_trace_open(trace_file);
+		if (err < 0)
+			log_msg(0, "Can't open trace file %s: %s\n", trace_file, strerror(-err));
 	}
+
+	err = coord_persist_start(lease_file);
+	if (err < 0) {
+		log_msg(0, "Can't start lease persistence: %s\n", strerror(-err));
+		cleanup(1);
+	}
+	addrdb_set_notify(lease_notify);
+
+	if (takeover)
+		err = coord_ctl_adopt(handoff.ctl_fd, ctl_socket);
+	else
+		err = coord_ctl_init(ctl_socket);
+	if (err < 0) {
+		log_msg(0, "Can't create control socket %s: %s\n", ctl_socket, strerror(-err));
+		cleanup(1);
+	}
+
+	if (standby_listen) {
+		err = coord_ctl_listen_tcp(standby_listen);
+		/* Our predecessor lets go of the port right after the handoff */
+		for (i = 0; takeover && err == -EADDRINUSE && i < 20; i++) {
+			usleep(50000);
+			err = coord_ctl_listen_tcp(standby_listen);
+		}
+		if (err < 0) {
+			log_msg(0, "Can't listen for standbys on %s: %s\n",
+					standby_listen, strerror(-err));
+			cleanup(1);
+		}
+	}
+
+	hup_fd = signalfd(-1, &hup, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (hup_fd < 0)
+		log_msg(0, "signalfd: %s, SIGHUP is ignored\n", strerror(errno));
+	else
+		coord_loop_add(hup_fd, POLLIN, sighup_cb, NULL);
+
+	if (primary) {
+		err = coord_standby_start(primary);
+		if (err < 0) {
+			log_msg(0, "Can't follow %s: %s\n", primary, strerror(-err));
+			cleanup(1);
+		}
+		coord_loop_run(&standby_flag);
+		if (die_flag)
+			cleanup(0);
+	}
+
+	/* The mock starts a thread, so this too has to wait for daemon() */
+	if (!takeover)
+		family = transport->open(transport_arg);
+	else if (transport->adopt)
+		family = transport->adopt(handoff.nl_fd, handoff.family);
+	else
+		family = -NLE_OPNOTSUPP;
+	if (family < 0) {
+		log_msg(0, "Can't open %s transport: %s\n", transport->name, nl_geterror(family));
+		cleanup(1);
+	}
+
+	coord_loop_add(transport->get_fd(), POLLIN, transport_event_cb, NULL);
+
+	/* Last, so that only this thread gets the real-time policy */
+	if (rt_mode && coord_rt_start(rt_prio) < 0)
+		cleanup(1);
+
+	pan_id = pan;
+	pan_short = short_addr;
+	pan_channel = channel;
+
+	/* A taken over PAN is running already */
+	if (!takeover)
+		mlme_start(short_addr, pan, channel, 1, iface);
+
+	/* The mock has no interface to follow */
+	err = transport == &coord_mock_transport ? 0 : coord_link_init(iface);
+	if (err < 0)
+		log_msg(0, "Can't follow %s: %s, PAN is not restarted after link down\n",
+				iface, strerror(-err));
+
+	coord_loop_run(&die_flag);
 	cleanup(0);
 
 	return 0;
@@ -0,0 +1,455 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Copyright (C) 2008, 2009 Siemens AG
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <addrdb.h>
+
+#include "coord-trace.h"
+
+/*
+ * MLME transport (coord-netlink.c, coord-mock.c)
+ *
+ * Requests are built as generic netlink messages whatever the transport;
+ * a transport only moves them. Incoming messages are handed to
+ * coord_mlme_input().
+ */
+struct nl_msg;
+
+struct coord_transport {
+	const char *name;
+	/* Returns the 802.15.4 generic netlink family id or a negative error */
+	int (*open)(const char *arg);
+	int (*get_fd)(void);
+	/* Same return convention as nl_send_auto_complete() */
+	int (*send)(struct nl_msg *msg);
+	/* Dispatches what is pending; a negative value means the peer is gone */
+	int (*recv)(void);
+	void (*close)(void);
+	/* Like open, but on a socket inherited from a previous instance */
+	int (*adopt)(int fd, int family);
+	/* Sends a data frame from src to dst in pan_id; 0 or a negative errno */
+	int (*data)(uint16_t pan_id, uint16_t src, uint16_t dst,
+			const void *buf, size_t len);
+};
+
+extern const struct coord_transport coord_netlink_transport;
+extern const struct coord_transport coord_mock_transport;
+
+int coord_mlme_input(struct nl_msg *msg);
+
+/*
+ * Associations waiting for COMM_STATUS (coord-pending.c)
+ */
+int coord_pending_init(void);
+int coord_pending_add(const uint8_t *hwa);
+void coord_pending_set_window(unsigned int ms);
+int coord_pending_duplicate(const uint8_t *hwa, uint64_t now_ns);
+void coord_pending_status(const uint8_t *hwa, uint8_t status);
+void coord_pending_commit_all(void);
+
+/*
+ * Admission lists (coord-acl.c)
+ */
+int coord_acl_load(const char *allow, const char *deny);
+int coord_acl_reload(const char *allow, const char *deny);
+void coord_acl_stop(void);
+/* 0 if hwa is on the deny list, or not on the allow list */
+int coord_acl_admit(const uint8_t *hwa);
+
+/*
+ * Lease change feed (coord-feed.c)
+ */
+void coord_feed_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp);
+
+/*
+ * Configuration (coord-config.c)
+ *
+ * Everything that can change without a restart. A reload starts over
+ * from the command line settings and applies the file on top of them.
+ */
+struct coord_config {
+	int range_min, range_max;
+	int debug;
+	char lease_file[PATH_MAX];
+	unsigned int dev_rate, dev_burst;
+	unsigned int global_rate, global_burst;
+	unsigned long resp_budget_us;
+	unsigned int dedup_window_ms;
+	char allow_list[PATH_MAX], deny_list[PATH_MAX];	/* "": none */
+	unsigned int tree_cm, tree_rm, tree_lm;	/* tree_cm 0: flat */
+	unsigned int bcn_ord, sf_ord;	/* 15: no beacons */
+};
+
+int coord_config_load(const char *path, struct coord_config *cfg);
+/* "children:routers:depth" of tree mode */
+int coord_config_parse_tree(const char *arg, struct coord_config *cfg);
+/* "beacon_order:superframe_order" of a beacon-enabled PAN */
+int coord_config_parse_beacon(const char *arg, struct coord_config *cfg);
+/* Provided by coordinator.c: re-read the file, apply all of it or nothing */
+int coord_reload(void);
+
+/*
+ * Hot upgrade (coord-handoff.c)
+ *
+ * A new instance started with -H asks the running one for its netlink
+ * and control sockets and its lease table over the control socket, then
+ * serves on the very same sockets without rejoining anything.
+ */
+struct coord_handoff {
+	int nl_fd;
+	int ctl_fd;
+	int family;
+	char iface[IFNAMSIZ];
+};
+
+int coord_handoff_receive(const char *ctl_path, struct coord_handoff *h);
+
+/* Provided by coordinator.c for the sending side */
+int coord_handoff_release(struct coord_handoff *h);
+void coord_handoff_resume(void);
+void coord_handoff_done(void);
+
+/*
+ * Lease persistence (coord-persist.c)
+ *
+ * The netlink thread only queues lease mutations; a separate thread
+ * owns the lease file and rewrites it whenever the table changed.
+ */
+int coord_persist_start(const char *lease_file);
+void coord_persist_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr, time_t stamp);
+void coord_persist_flush(void);	/* async-signal-safe */
+void coord_persist_stop(void);
+
+/*
+ * Association rate limiting (coord-ratelimit.c)
+ */
+int coord_ratelimit_parse(const char *arg, unsigned int *rate, unsigned int *burst);
+int coord_ratelimit_init(unsigned int dev_rate, unsigned int dev_burst,
+		unsigned int global_rate, unsigned int global_burst);
+int coord_ratelimit_admit(const uint8_t *hwa, uint64_t now_ns);
+
+/*
+ * Hot standby (coord-standby.c)
+ *
+ * A standby follows the lease feed of its primary over the control
+ * socket or TCP, keeping the same lease table, and takes over once the
+ * primary has gone silent.
+ */
+int coord_standby_start(const char *primary);
+/* Provided by coordinator.c: stop following and start serving the PAN */
+void coord_standby_promote(void);
+
+/*
+ * Interface state (coord-link.c)
+ */
+int coord_link_init(const char *iface);
+/* Provided by coordinator.c: the interface is back, start the PAN again */
+void coord_link_up(void);
+
+/*
+ * Guaranteed time slots (coord-gts.c)
+ *
+ * The kernel has no GTS attributes yet: GTS_INDIC and GTS_CONF carry
+ * the GTS characteristics octet in ATTR_CAPABILITY, it being the one
+ * octet payload of the GTS request command like the capability octet
+ * is for association, and GTS_CONF the starting slot in ATTR_DURATION.
+ */
+#define IEEE802154_SUCCESS		0x00
+#define IEEE802154_DENIED		0xe2
+#define IEEE802154_INVALID_PARAMETER	0xe8
+
+#define IEEE802154_GTS_LEN	0x0f	/* slots */
+#define IEEE802154_GTS_RX	0x10	/* direction: the device receives */
+#define IEEE802154_GTS_ALLOC	0x20	/* characteristics type */
+
+void coord_gts_init(unsigned int bcn_ord, unsigned int sf_ord);
+void coord_gts_request(uint16_t short_addr, uint8_t characteristics);
+void coord_gts_release(uint16_t short_addr);
+void coord_gts_release_all(void);
+/* Provided by coordinator.c: tell the MAC about a GTS, or a refusal */
+void coord_gts_notify(uint16_t short_addr, uint8_t characteristics,
+		uint8_t start, uint8_t status);
+
+/*
+ * Indirect transmission (coord-indirect.c)
+ *
+ * The kernel does not hand data requests to userspace yet: one arrives
+ * as POLL_REQ on the coordinator group, the device in SRC_SHORT_ADDR or
+ * SRC_HW_ADDR. The answer leaves through the transport's data socket
+ * right away, while the device still listens after its acknowledgement.
+ */
+/* aMaxPHYPacketSize less the shortest header of a frame to a device */
+#define INDIRECT_PAYLOAD_MAX	116
+
+int coord_indirect_parse(const char *arg, unsigned int *frames,
+		unsigned int *per_dev, unsigned int *persistence);
+int coord_indirect_init(unsigned int frames, unsigned int per_dev,
+		unsigned int persistence, uint8_t channel, unsigned int bcn_ord);
+/* hwa may be NULL, then the device is found by short_addr */
+int coord_indirect_queue(const uint8_t *hwa, uint16_t short_addr,
+		const void *data, size_t len);
+void coord_indirect_poll(const uint8_t *hwa, uint16_t short_addr);
+void coord_indirect_lease(enum addrdb_event ev, const uint8_t *hwa,
+		uint16_t short_addr);
+void coord_indirect_stats(unsigned int *frames, unsigned int *devices,
+		unsigned int *capacity);
+/* Provided by coordinator.c: transmit a frame to a device of our PAN */
+int coord_indirect_send(uint16_t short_addr, const void *buf, size_t len);
+
+/*
+ * Real-time mode (coord-rt.c)
+ */
+int coord_rt_parse_cpus(const char *arg);
+int coord_rt_start(int priority);
+
+/*
+ * Event loop (coord-loop.c)
+ */
+typedef void (*coord_fd_cb)(int fd, short revents, void *arg);
+
+/* Zero it before first use; callbacks run from coord_loop_run() */
+struct coord_timer {
+	void (*cb)(void *arg);
+	void *arg;
+	uint64_t expires;	/* in loop ticks */
+	struct coord_timer *next, **pprev;
+};
+
+int coord_loop_add(int fd, short events, coord_fd_cb cb, void *arg);
+void coord_loop_set_events(int fd, short events);
+void coord_loop_del(int fd);
+int coord_loop_run(volatile sig_atomic_t *stop);
+/* (Re-)arms t to fire after at least ms milliseconds */
+void coord_timer_add(struct coord_timer *t, unsigned int ms);
+void coord_timer_del(struct coord_timer *t);
+
+/*
+ * Control socket (coord-ctl.c)
+ */
+struct coord_ctl_client {
+	int fd;
+	int remote;	/* connected over TCP */
+	char in[256];
+	size_t in_len;
+
+	char *out;
+	size_t out_len, out_size, out_off;
+
+	/*
+	 * Set by a command that streams its answer: called whenever the
+	 * output buffer has drained, returns 0 once everything was sent.
+	 * If it adds nothing, the stream sleeps until coord_ctl_wake().
+	 */
+	int (*more)(struct coord_ctl_client *c);
+	/* Called when the client goes away */
+	void (*release)(struct coord_ctl_client *c);
+	void *priv;
+
+	struct coord_ctl_client *next;
+};
+
+struct coord_ctl_cmd {
+	const char *name;
+	const char *usage;
+	int (*call)(struct coord_ctl_client *c, int argc, char **argv);
+	int remote;	/* allowed over TCP */
+};
+
+struct coord_ctl_module {
+	const char *name;
+	const struct coord_ctl_cmd commands[];
+};
+
+int coord_ctl_init(const char *path);
+int coord_ctl_adopt(int fd, const char *path);
+int coord_ctl_resolve(const char *arg, int passive,
+		struct sockaddr_storage *ss, socklen_t *len);
+int coord_ctl_listen_tcp(const char *arg);
+int coord_ctl_listen_fd(void);
+void coord_ctl_detach(void);
+void coord_ctl_close(void);
+int coord_ctl_printf(struct coord_ctl_client *c, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int coord_ctl_error(struct coord_ctl_client *c, const char *msg);
+void coord_ctl_wake(struct coord_ctl_client *c);
+
+/*
+ * Metrics (coord-metrics.c)
+ *
+ * Every counter and histogram has exactly one writer thread, so updates
+ * are plain relaxed load/store pairs without any locked instruction.
+ */
+enum coord_counter {
+	COORD_CNT_ASSOC,
+	COORD_CNT_DISASSOC,
+	COORD_CNT_ALLOC_FAIL,
+	COORD_CNT_NL_ERROR,
+	COORD_CNT_SEQ_MISMATCH,
+	COORD_CNT_RATELIMIT_DEV,
+	COORD_CNT_RATELIMIT_GLOBAL,
+	COORD_CNT_ORPHAN,
+	COORD_CNT_ORPHAN_UNKNOWN,
+	COORD_CNT_DEADLINE_MISS,
+	COORD_CNT_FEED_OVERRUN,
+	COORD_CNT_ASSOC_ROLLBACK,
+	COORD_CNT_ASSOC_TIMEOUT,
+	COORD_CNT_ASSOC_DUP,
+	COORD_CNT_ACL_DENIED,
+	COORD_CNT_PAN_RESTART,
+	COORD_CNT_GTS_DENIED,
+	COORD_CNT_INDIRECT_QUEUED,
+	COORD_CNT_INDIRECT_SENT,
+	COORD_CNT_INDIRECT_NO_DATA,
+	COORD_CNT_INDIRECT_OVERFLOW,
+	COORD_CNT_INDIRECT_EXPIRED,
+	COORD_CNT_INDIRECT_PURGED,
+	__COORD_CNT_MAX,
+};
+
+enum coord_hist {
+	COORD_HIST_ASSOC_LATENCY,	/* netlink thread */
+	COORD_HIST_FLUSH,		/* persistence thread */
+	__COORD_HIST_MAX,
+};
+
+/* Bucket i counts samples below 2^i microseconds, the last one is +Inf */
+#define COORD_HIST_BUCKETS	24
+#define COORD_RATE_SLOTS	16
+
+struct coord_hist_data {
+	uint64_t bucket[COORD_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+};
+
+/* Events per second for the last COORD_RATE_SLOTS seconds */
+struct coord_rate {
+	uint32_t sec[COORD_RATE_SLOTS];
+	uint32_t count[COORD_RATE_SLOTS];
+};
+
+struct coord_metrics {
+	uint64_t counter[__COORD_CNT_MAX];
+	struct coord_rate rate[__COORD_CNT_MAX];
+	struct coord_hist_data hist[__COORD_HIST_MAX];
+};
+
+extern struct coord_metrics coord_metrics;
+
+static inline uint64_t coord_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define coord_metric_add(p, v) \
+	__atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (v), \
+			__ATOMIC_RELAXED)
+
+static inline void coord_count(enum coord_counter c)
+{
+	coord_metric_add(&coord_metrics.counter[c], 1);
+}
+
+/* Like coord_count(), but also feeds the per-second rate of the counter */
+static inline void coord_count_at(enum coord_counter c, uint64_t now_ns)
+{
+	struct coord_rate *r = &coord_metrics.rate[c];
+	uint32_t sec = now_ns / 1000000000ULL;
+	unsigned int slot = sec % COORD_RATE_SLOTS;
+
+	coord_count(c);
+	if (r->sec[slot] != sec) {
+		__atomic_store_n(&r->count[slot], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&r->sec[slot], sec, __ATOMIC_RELAXED);
+	}
+	coord_metric_add(&r->count[slot], 1);
+}
+
+static inline void coord_observe(enum coord_hist h, uint64_t ns)
+{
+	struct coord_hist_data *d = &coord_metrics.hist[h];
+	uint64_t us = ns / 1000;
+	int i = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (i >= COORD_HIST_BUCKETS)
+		i = COORD_HIST_BUCKETS - 1;
+	coord_metric_add(&d->bucket[i], 1);
+	coord_metric_add(&d->count, 1);
+	coord_metric_add(&d->sum_ns, ns);
+	if (ns > d->max_ns)
+		__atomic_store_n(&d->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+/*
+ * Event trace (coord-trace.c)
+ *
+ * Recording costs one atomic add and a 32 byte store, so it is cheap
+ * enough to stay enabled on production systems.
+ */
+extern struct coord_trace_hdr *coord_trace_buf;
+
+int coord_trace_open(const char *path);
+void coord_trace_close(void);
+
+static inline void coord_trace(enum coord_trace_event ev, const uint8_t *hwa,
+		uint16_t short_addr, uint32_t arg, uint32_t arg2)
+{
+	struct coord_trace_hdr *hdr = coord_trace_buf;
+	struct coord_trace_rec *rec;
+	uint64_t idx;
+
+	if (!hdr)
+		return;
+
+	idx = __atomic_fetch_add(&hdr->head, 1, __ATOMIC_RELAXED);
+	rec = &hdr->rec[idx & (COORD_TRACE_RECORDS - 1)];
+
+	/* Invalidate first, so a reader never mixes two generations */
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->ts = coord_now_ns();
+	if (hwa)
+		memcpy(rec->hwaddr, hwa, sizeof(rec->hwaddr));
+	else
+		memset(rec->hwaddr, 0, sizeof(rec->hwaddr));
+	rec->arg = arg;
+	rec->arg2 = arg2;
+	rec->event = ev;
+	rec->short_addr = short_addr;
+	__atomic_store_n(&rec->seq, (uint32_t)(idx + 1), __ATOMIC_RELEASE);
+}
+
+#endif
@@ -27,6 +27,8 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
+#include <poll.h>
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
@@ -34,6 +36,7 @@
 #include <ieee802154.h>
 #include <nl802154.h>
 #include <libcommon.h>
+#include <izevent.h>
 
 #include "iz.h"
 
@@ -70,18 +73,6 @@ static iz_res_t help_parse(struct iz_cmd *cmd)
 /* EVENT handling */
 /******************/
 
-static iz_res_t event_parse(struct iz_cmd *cmd)
-{
-	cmd->flags = 0;
-
-	if (cmd->argc > 2) {
-		printf("Too many arguments!\n");
-		return IZ_STOP_ERR;
-	}
-
-	return IZ_CONT_OK;
-}
-
 static char *iz_cmd_names[__IEEE802154_CMD_MAX + 1] = {
 	[0 ... __IEEE802154_CMD_MAX] = "?? unknown ??",
 	[__IEEE802154_COMMAND_INVALID] = "IEEE802154_COMMAND_INVALID",
@@ -123,22 +114,81 @@ static char *iz_cmd_names[__IEEE802154_CMD_MAX + 1] = {
 };
 
 
-static iz_res_t event_response(struct iz_cmd *cmd, struct genlmsghdr *ghdr, struct nlattr **attrs)
+static void event_print(struct iz_cmd *cmd, const char *iface, int nl_cmd)
 {
-	const char *iface = nla_get_string(attrs[IEEE802154_ATTR_DEV_NAME]);
-
 	if (cmd->argv[1] && (!iface || strcmp(cmd->argv[1], iface)))
-		return IZ_CONT_OK;
+		return;
 
 	if (!iface)
 		iface = "?????";
 
-	if (ghdr->cmd < __IEEE802154_CMD_MAX)
-		fprintf(stdout, "%s: %s (%i)\n", iface, iz_cmd_names[ghdr->cmd], ghdr->cmd);
+	if (nl_cmd < __IEEE802154_CMD_MAX)
+		fprintf(stdout, "%s: %s (%i)\n", iface, iz_cmd_names[nl_cmd], nl_cmd);
 	else
-		fprintf(stdout, "%s: UNKNOWN (%i)\n", iface, ghdr->cmd);
+		fprintf(stdout, "%s: UNKNOWN (%i)\n", iface, nl_cmd);
 
 	fflush(stdout);
+}
+
+/* Read what izeventd decoded for us, until interrupted */
+static iz_res_t event_ring(struct iz_cmd *cmd, struct izevent_reader *r)
+{
+	struct pollfd pfd = { .fd = izevent_fd(r), .events = POLLIN };
+	const struct izevent *ev;
+	uint64_t lost = 0;
+
+	for (;;) {
+		izevent_ack(r);
+		while ((ev = izevent_peek(r))) {
+			char iface[IZEVENT_NAME_LEN];
+			int nl_cmd = ev->cmd;
+			int named = IZEVENT_HAS(ev, IEEE802154_ATTR_DEV_NAME);
+
+			memcpy(iface, ev->dev_name, sizeof(iface));
+			if (!izevent_done(r, ev))
+				event_print(cmd, named ? iface : NULL, nl_cmd);
+		}
+
+		if (izevent_lost(r) != lost) {
+			fprintf(stderr, "%llu events lost\n",
+					(unsigned long long)(izevent_lost(r) - lost));
+			lost = izevent_lost(r);
+		}
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			perror("poll");
+			izevent_close(r);
+			return IZ_STOP_ERR;
+		}
+	}
+}
+
+static iz_res_t event_parse(struct iz_cmd *cmd)
+{
+	struct izevent_reader *r;
+
+	cmd->flags = 0;
+
+	if (cmd->argc > 2) {
+		printf("Too many arguments!\n");
+		return IZ_STOP_ERR;
+	}
+
+	/*
+	 * With izeventd running we need no netlink socket of our own. The
+	 * ring is read until interrupted, so not when others wait for us.
+	 */
+	if (!cmd->nonblock && !izevent_open(EVENT_SOCKET, &r))
+		return event_ring(cmd, r);
+
+	return IZ_CONT_OK;
+}
+
+static iz_res_t event_response(struct iz_cmd *cmd, struct genlmsghdr *ghdr, struct nlattr **attrs)
+{
+	const char *iface = nla_get_string(attrs[IEEE802154_ATTR_DEV_NAME]);
+
+	event_print(cmd, iface, ghdr->cmd);
 
 	return IZ_CONT_OK;
 }
@@ -44,6 +44,7 @@
 static iz_res_t scan_parse(struct iz_cmd *cmd)
 {
 	cmd->flags = NLM_F_REQUEST;
+	cmd->iface = cmd->argv[1];
 	return IZ_CONT_OK;
 }
 
@@ -260,6 +261,7 @@ static struct iz_cmd_event list_response_event[] = {
 static iz_res_t set_parse(struct iz_cmd *cmd)
 {
 	cmd->flags = NLM_F_REQUEST;
+	cmd->iface = cmd->argv[1];
 	return IZ_CONT_OK;
 }
 
@@ -344,6 +346,7 @@ static struct iz_cmd_event set_response_event[] = {
 static iz_res_t assoc_parse(struct iz_cmd *cmd)
 {
 	cmd->flags = NLM_F_REQUEST;
+	cmd->iface = cmd->argv[1];
 	return IZ_CONT_OK;
 }
 
@@ -447,6 +450,7 @@ static struct iz_cmd_event assoc_response_event[] = {
 static iz_res_t disassoc_parse(struct iz_cmd *cmd)
 {
 	cmd->flags = NLM_F_REQUEST;
+	cmd->iface = cmd->argv[1];
 	return IZ_CONT_OK;
 }
 
@@ -28,6 +28,8 @@
 #endif
 
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <netlink/netlink.h>
@@ -35,30 +37,38 @@
 #include <netlink/genl/ctrl.h>
 #include <getopt.h>
 
+#include <poll.h>
+#include <time.h>
+
 #include <ieee802154.h>
 #include <nl802154.h>
 #include <libcommon.h>
+#include <probes.h>
 
 #include "iz.h"
 
 static int iz_cb_seq_check(struct nl_msg *msg, void *arg);
 static int iz_cb_valid(struct nl_msg *msg, void *arg);
 static int iz_cb_finish(struct nl_msg *msg, void *arg);
+static int iz_cb_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg);
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option iz_long_opts[] = {
 	{ "debug", optional_argument, NULL, 'd' },
+	{ "batch", required_argument, NULL, 'b' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "timeout", required_argument, NULL, 't' },
 	{ "version", no_argument, NULL, 'v' },
 	{ "help", no_argument, NULL, 'h' },
 	{ NULL, 0, NULL, 0 },
 };
 #endif
 
-/* Expected sequence number */
-static int iz_seq = 0;
-
 /* Parsed options */
 static int iz_debug = 0;
+/* Requests in flight at most, and how long each may take (0: forever) */
+static unsigned int iz_jobs = 8;
+static unsigned int iz_timeout_ms = 0;
 
 #define dprintf(lvl, fmt...)			\
 	do {					\
@@ -67,8 +77,31 @@ static int iz_debug = 0;
 	} while(0)
 
 
-/* Exit from receive loop (set from receive callback) */
-static int iz_exit = 0;
+/* Netlink session, shared by all commands of a batch */
+static struct nl_sock *iz_nl;
+static int iz_family;
+
+/* Most arguments a batch line may have */
+#define IZ_BATCH_ARGS	32
+
+/*
+ * A command in flight. Replies find it by their sequence number,
+ * multicast confirmations by the command and interface they are for.
+ */
+struct iz_req {
+	struct iz_cmd cmd;
+	uint64_t deadline;	/* ms, 0: none */
+	/* Called once when the command has finished, then req is freed */
+	void (*done)(struct iz_req *req, iz_res_t res);
+	void *priv;		/* for done */
+	unsigned int lineno;	/* batch only */
+	char *line;		/* what argv points into, batch only */
+	char *argv[IZ_BATCH_ARGS + 1];
+	struct iz_req *next;
+};
+
+static struct iz_req *iz_inflight;
+static unsigned int iz_ninflight;
 
 extern const struct iz_module iz_common;
 extern const struct iz_module iz_mac;
@@ -96,27 +129,362 @@ const struct iz_cmd_desc *get_cmd(const char *name)
 	return NULL;
 }
 
+static uint64_t iz_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* Connects and resolves the family once; 0 on success */
+static int iz_nl_open(void)
+{
+	int group;
+
+	iz_nl = nl_socket_alloc();
+	if (!iz_nl) {
+		nl_perror(NLE_NOMEM, "Could not allocate NL handle");
+		return -1;
+	}
+	genl_connect(iz_nl);
+	iz_family = nl_get_family_id(iz_nl, IEEE802154_NL_NAME);
+	if (iz_family < 0) {
+		fprintf(stderr, "Could not resolve %s family: %s\n", IEEE802154_NL_NAME, strerror(-iz_family));
+		return -1;
+	}
+	group = nl_get_multicast_id(iz_nl,
+			IEEE802154_NL_NAME, IEEE802154_MCAST_COORD_NAME);
+	if (group < 0) {
+		fprintf(stderr, "Could not get multicast group ID: %s\n", strerror(-group));
+		return -1;
+	}
+	nl_socket_add_membership(iz_nl, group);
+	nl_socket_modify_cb(iz_nl, NL_CB_VALID, NL_CB_CUSTOM,
+		iz_cb_valid, NULL);
+	nl_socket_modify_cb(iz_nl, NL_CB_FINISH, NL_CB_CUSTOM,
+		iz_cb_finish, NULL);
+	nl_socket_modify_cb(iz_nl, NL_CB_SEQ_CHECK, NL_CB_CUSTOM,
+		iz_cb_seq_check, NULL);
+	nl_socket_modify_err_cb(iz_nl, NL_CB_CUSTOM, iz_cb_error, NULL);
+
+	return 0;
+}
+
+static struct iz_req *iz_req_find(uint32_t seq)
+{
+	struct iz_req *req;
+
+	for (req = iz_inflight; req; req = req->next)
+		if (req->cmd.desc->request && req->cmd.seq == seq)
+			return req;
+
+	return NULL;
+}
+
+static void iz_req_done(struct iz_req *req, iz_res_t res)
+{
+	struct iz_req **p;
+
+	for (p = &iz_inflight; *p != req; p = &(*p)->next)
+		;
+	*p = req->next;
+	iz_ninflight--;
+
+	req->done(req, res);
+	free(req->line);
+	free(req);
+}
+
+/* Hands a message to req if it is one req waits for */
+static void iz_req_input(struct iz_req *req, struct genlmsghdr *ghdr,
+		struct nlattr **attrs)
+{
+	const struct iz_cmd_event *ev;
+	iz_res_t res;
+
+	if (!req->cmd.desc->response)
+		return;
+
+	for (ev = req->cmd.desc->response; ev->nl; ev++) {
+		if (ev->nl != ghdr->cmd && ev->nl != IZ_RESPONSE_ALL)
+			continue;
+		res = ev->call(&req->cmd, ghdr, attrs);
+		if (res != IZ_CONT_OK)
+			iz_req_done(req, res);
+		return;
+	}
+}
+
+/*
+ * Two commands may be in flight together unless they work on the same
+ * interface or phy. One that names no interface (lists, or a name
+ * still to be picked by the kernel) may depend on anything.
+ */
+static int iz_conflict(const struct iz_cmd *a, const struct iz_cmd *b)
+{
+	if ((a->flags | b->flags) & NLM_F_DUMP)
+		return 1;
+	if (!a->iface || !b->iface || strchr(a->iface, '%') || strchr(b->iface, '%'))
+		return 1;
+	if (!strcmp(a->iface, b->iface))
+		return 1;
+
+	return a->phy && b->phy && !strcmp(a->phy, b->phy);
+}
+
+static int iz_can_start(const struct iz_req *req)
+{
+	const struct iz_req *r;
+
+	if (iz_ninflight >= iz_jobs)
+		return 0;
+
+	for (r = iz_inflight; r; r = r->next)
+		if (iz_conflict(&req->cmd, &r->cmd))
+			return 0;
+
+	return 1;
+}
+
+/* Sends the request of a parsed command; req is in flight afterwards */
+static void iz_start(struct iz_req *req)
+{
+	struct iz_cmd *cmd = &req->cmd;
+	struct nl_msg *msg;
+	int err;
+
+	req->next = iz_inflight;
+	iz_inflight = req;
+	iz_ninflight++;
+	if (iz_timeout_ms)
+		req->deadline = iz_now_ms() + iz_timeout_ms;
+
+	/* Send request, if necessary */
+	if (!cmd->desc->request)
+		return;
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		nl_perror(NLE_NOMEM, "Could not allocate NL message!\n"); /* FIXME: err */
+		iz_req_done(req, IZ_STOP_ERR);
+		return;
+	}
+	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, iz_family, 0,
+		cmd->flags, cmd->desc->nl_cmd, 1);
+
+	if (cmd->desc->request(cmd, msg) != IZ_CONT_OK) {
+		printf("Request processing error!\n");
+		nlmsg_free(msg);
+		iz_req_done(req, IZ_STOP_ERR);
+		return;
+	}
+
+	dprintf(1, "nl_send_auto_complete\n");
+	err = nl_send_auto_complete(iz_nl, msg);
+	cmd->seq = nlmsg_hdr(msg)->nlmsg_seq;
+	PROBE2(iz, request, cmd->desc->nl_cmd, cmd->seq);
+
+	dprintf(1, "nlmsg_free\n");
+	nlmsg_free(msg);
+
+	if (err < 0) {
+		nl_perror(err, "Send failed");
+		iz_req_done(req, IZ_STOP_ERR);
+	}
+}
+
+/* Handles what arrives until the next deadline; 0, or -1 if the socket failed */
+static int iz_wait(void)
+{
+	struct pollfd pfd = { .fd = nl_socket_get_fd(iz_nl), .events = POLLIN };
+	struct iz_req *req, *next;
+	uint64_t now = iz_now_ms(), first = 0;
+	int timeout = -1, err;
+
+	for (req = iz_inflight; req; req = req->next)
+		if (req->deadline && (!first || req->deadline < first))
+			first = req->deadline;
+	if (first)
+		timeout = first > now ? first - now : 0;
+
+	if (poll(&pfd, 1, timeout) > 0) {
+		err = nl_recvmsgs_default(iz_nl);
+		if (err < 0) {
+			nl_perror(err, "Receive failed");
+			while (iz_inflight)
+				iz_req_done(iz_inflight, IZ_STOP_ERR);
+			return -1;
+		}
+	}
+
+	now = iz_now_ms();
+	for (req = iz_inflight; req; req = next) {
+		next = req->next;
+		if (req->deadline && req->deadline <= now) {
+			printf("%s: timed out\n", req->cmd.desc->name);
+			iz_req_done(req, IZ_STOP_ERR);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Parses a command into req. Returns IZ_CONT_OK if it has to go to the
+ * kernel, IZ_STOP_OK or IZ_STOP_ERR if it is done with already.
+ */
+static iz_res_t iz_parse(struct iz_req *req, int argc, char **argv)
+{
+	struct iz_cmd *cmd = &req->cmd;
+	iz_res_t res;
+
+	cmd->argc = argc;
+	cmd->argv = argv;
+	cmd->nonblock = req->line || iz_timeout_ms;
+
+	/* Parse command */
+	cmd->desc = get_cmd(argv[0]);
+	if (!cmd->desc) {
+		printf("Unknown command %s!\n", argv[0]);
+		return IZ_STOP_ERR;
+	}
+	if (cmd->desc->parse) {
+		res = cmd->desc->parse(cmd);
+		if (res == IZ_STOP_ERR)
+			printf("Command line parsing error!\n");
+		if (res != IZ_CONT_OK)
+			return res;
+	}
+
+	if (!iz_nl && iz_nl_open())
+		return IZ_STOP_ERR;
+
+	return IZ_CONT_OK;
+}
+
+static void iz_batch_done(struct iz_req *req, iz_res_t res)
+{
+	unsigned int *failed = req->priv;
+
+	if (res == IZ_STOP_ERR)
+		(*failed)++;
+	printf("line %u: %s\n", req->lineno, res == IZ_STOP_ERR ? "failed" : "ok");
+	fflush(stdout);
+}
+
+/* Breaks line up into req->argv; -1 if there are too many words */
+static int iz_batch_split(struct iz_req *req)
+{
+	char *p;
+	int argc = 0;
+
+	for (p = strtok(req->line, " \t\r\n"); p && *p != '#';
+	     p = strtok(NULL, " \t\r\n")) {
+		if (argc == IZ_BATCH_ARGS)
+			return -1;
+		req->argv[argc++] = p;
+	}
+	req->argv[argc] = NULL;
+
+	return argc;
+}
+
+/*
+ * Runs the commands of path ("-": standard input), one per line and
+ * written as on the command line, over a single netlink session. Up to
+ * iz_jobs commands are in flight at once, as long as they work on
+ * different interfaces. Each line is answered with "line N: ok" or
+ * "line N: failed" once its command has finished, so answers may come
+ * out of order. Returns the number of failed lines.
+ */
+static int iz_batch(const char *path)
+{
+	char *line = NULL;
+	unsigned int lineno = 0, failed = 0;
+	size_t size = 0;
+	struct iz_req *req;
+	iz_res_t res;
+	FILE *f;
+	int argc;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (getline(&line, &size, f) >= 0) {
+		lineno++;
+
+		req = calloc(1, sizeof(*req));
+		if (!req || !(req->line = strdup(line))) {
+			free(req);
+			fprintf(stderr, "Out of memory\n");
+			failed++;
+			break;
+		}
+		req->lineno = lineno;
+		req->done = iz_batch_done;
+		req->priv = &failed;
+
+		argc = iz_batch_split(req);
+		if (!argc) {
+			free(req->line);
+			free(req);
+			continue;
+		}
+
+		if (argc < 0) {
+			printf("Too many arguments!\n");
+			res = IZ_STOP_ERR;
+		} else {
+			res = iz_parse(req, argc, req->argv);
+		}
+		if (res != IZ_CONT_OK) {
+			iz_batch_done(req, res);
+			free(req->line);
+			free(req);
+			continue;
+		}
+
+		while (!iz_can_start(req))
+			iz_wait();
+		iz_start(req);
+	}
+
+	while (iz_inflight)
+		iz_wait();
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	return failed;
+}
+
+static void iz_single_done(struct iz_req *req, iz_res_t res)
+{
+	*(iz_res_t *)req->priv = res;
+}
+
 int main(int argc, char **argv)
 {
 	int c;
 	int i;
-	int family;
-	int group;
-	struct nl_sock *nl;
-	struct nl_msg *msg;
 	char *dummy = NULL;
-
-	/* Currently processed command info */
-	struct iz_cmd cmd;
+	const char *batch = NULL;
+	struct iz_req *req;
+	iz_res_t res;
 
 
 	/* Parse options */
 	while (1) {
 #ifdef HAVE_GETOPT_LONG
 		int opt_idx = -1;
-		c = getopt_long(argc, argv, "d::vh", iz_long_opts, &opt_idx);
+		c = getopt_long(argc, argv, "d::b:j:t:vh", iz_long_opts, &opt_idx);
 #else
-		c = getopt(argc, argv, "d::vh");
+		c = getopt(argc, argv, "d::b:j:t:vh");
 #endif
 		if (c == -1)
 			break;
@@ -134,6 +502,23 @@ int main(int argc, char **argv)
 			} else
 				iz_debug = nl_debug = 1;
 			break;
+		case 'b':
+			batch = optarg;
+			break;
+		case 'j':
+			iz_jobs = strtoul(optarg, &dummy, 10);
+			if (*dummy || !iz_jobs) {
+				fprintf(stderr, "Error: incorrect number of jobs: '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 't':
+			iz_timeout_ms = strtoul(optarg, &dummy, 10);
+			if (*dummy) {
+				fprintf(stderr, "Error: incorrect timeout: '%s'\n", optarg);
+				exit(1);
+			}
+			break;
 		case 'v':
 			printf(	"iz " VERSION "\n"
 				"Copyright (C) 2008, 2009 by Siemens AG\n"
@@ -151,89 +536,37 @@ int main(int argc, char **argv)
 			return 1;
 		}
 	}
-	if (optind >= argc) {
+	if (batch ? optind < argc : optind >= argc) {
 		iz_help(argv[0]);
 		return 1;
 	}
 
-	memset(&cmd, 0, sizeof(cmd));
-
-	cmd.argc = argc - optind;
-	cmd.argv = argv + optind;
-
-	/* Parse command */
-	cmd.desc = get_cmd(argv[optind]);
-	if (!cmd.desc) {
-		printf("Unknown command %s!\n", argv[optind]);
-		return 1;
-	}
-	if (cmd.desc->parse) {
-		i = cmd.desc->parse(&cmd);
-		if (i == IZ_STOP_OK) {
-			return 0;
-		} else if (i == IZ_STOP_ERR) {
-			printf("Command line parsing error!\n");
+	if (batch) {
+		res = iz_batch(batch) ? IZ_STOP_ERR : IZ_STOP_OK;
+	} else {
+		req = calloc(1, sizeof(*req));
+		if (!req) {
+			fprintf(stderr, "Out of memory\n");
 			return 1;
 		}
-	}
-
-	/* Prepare NL command */
-	nl = nl_socket_alloc();
-	if (!nl) {
-		nl_perror(NLE_NOMEM, "Could not allocate NL handle");
-		return 1;
-	}
-	genl_connect(nl);
-	family = genl_ctrl_resolve(nl, IEEE802154_NL_NAME);
-	group = nl_get_multicast_id(nl,
-			IEEE802154_NL_NAME, IEEE802154_MCAST_COORD_NAME);
-	if (group < 0) {
-		fprintf(stderr, "Could not get multicast group ID: %s\n", strerror(-group));
-		return 1;
-	}
-	nl_socket_add_membership(nl, group);
-	iz_seq = nl_socket_use_seq(nl) + 1;
-	nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM,
-		iz_cb_valid, (void*)&cmd);
-	nl_socket_modify_cb(nl, NL_CB_FINISH, NL_CB_CUSTOM,
-		iz_cb_finish, (void*)&cmd);
-	nl_socket_modify_cb(nl, NL_CB_SEQ_CHECK, NL_CB_CUSTOM,
-		iz_cb_seq_check, (void*)&cmd);
-
-	/* Send request, if necessary */
-	if (cmd.desc->request) {
-		msg = nlmsg_alloc();
-		if (!msg) {
-			nl_perror(NLE_NOMEM, "Could not allocate NL message!\n"); /* FIXME: err */
-			return 1;
+		req->done = iz_single_done;
+		req->priv = &res;
+
+		res = iz_parse(req, argc - optind, argv + optind);
+		if (res == IZ_CONT_OK) {
+			iz_start(req);
+			/* Received message handling loop */
+			while (iz_inflight)
+				iz_wait();
+		} else {
+			free(req);
 		}
-		genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0,
-			cmd.flags, cmd.desc->nl_cmd, 1);
-
-		if (cmd.desc->request(&cmd, msg) != IZ_CONT_OK) {
-			printf("Request processing error!\n");
-			return 1;
-		}
-
-		dprintf(1, "nl_send_auto_complete\n");
-		nl_send_auto_complete(nl, msg);
-		cmd.seq = nlmsg_hdr(msg)->nlmsg_seq;
-
-		dprintf(1, "nlmsg_free\n");
-		nlmsg_free(msg);
 	}
 
-	/* Received message handling loop */
-	while (iz_exit == IZ_CONT_OK) {
-		int err = nl_recvmsgs_default(nl);
-		if (err != NLE_SUCCESS) {
-			nl_perror(err, "Receive failed");
-			return 1;
-		}
-	}
-	nl_close(nl);
+	if (iz_nl)
+		nl_close(iz_nl);
 
-	if (iz_exit == IZ_STOP_ERR)
+	if (res == IZ_STOP_ERR)
 		return 1;
 
 	return 0;
@@ -248,6 +581,11 @@ void iz_help(const char *pname)
 
 	printf("Options:\n");
 	printf("  -d, --debug[=N]                print netlink messages and other debug information\n");
+	printf("  -b, --batch=FILE               run the commands in FILE (- for standard input),\n"
+	       "                                 one per line, over a single netlink session\n");
+	printf("  -j, --jobs=N                   in batch mode, have up to N commands on different\n"
+	       "                                 interfaces in flight at once (default 8)\n");
+	printf("  -t, --timeout=MSEC             give up on a command after MSEC (default: never)\n");
 	printf("  -v, --version                  print version\n");
 	printf("  -h, --help                     print help\n");
 
@@ -266,7 +604,7 @@ void iz_help(const char *pname)
 	printf(PACKAGE_NAME " homepage <" PACKAGE_URL ">\n");
 }
 
-/* Callback for sequence number check */
+/* Callback for sequence number check: a reply to any request in flight */
 static int iz_cb_seq_check(struct nl_msg *msg, void *arg)
 {
 	uint32_t seq;
@@ -275,12 +613,10 @@ static int iz_cb_seq_check(struct nl_msg *msg, void *arg)
 		return NL_OK;
 
 	seq = nlmsg_hdr(msg)->nlmsg_seq;
-	if (seq == iz_seq) {
-		if (!(nlmsg_hdr(msg)->nlmsg_flags & NLM_F_MULTI))
-			iz_seq ++;
+	if (iz_req_find(seq))
 		return NL_OK;
-	}
-	printf("Sequence number mismatch (%i, %i)!", seq, iz_seq);
+
+	printf("Sequence number %u matches no request!\n", seq);
 	return NL_SKIP;
 }
 
@@ -290,21 +626,34 @@ static int iz_cb_valid(struct nl_msg *msg, void *arg)
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
 	struct nlattr *attrs[IEEE802154_ATTR_MAX+1];
         struct genlmsghdr *ghdr;
-	struct iz_cmd *cmd = arg;
-	int i;
+	struct iz_req *req, *next;
+	const char *name = NULL;
 
 	/* Validate message and parse attributes */
 	genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy);
 
         ghdr = nlmsg_data(nlh);
+	PROBE2(iz, response, ghdr->cmd, nlh->nlmsg_seq);
 
 	dprintf(1, "Received command %d (%d) for interface\n",
 			ghdr->cmd, ghdr->version);
 
-	for (i = 0; cmd->desc->response[i].nl; i++)
-		if (cmd->desc->response[i].nl == ghdr->cmd ||
-		    cmd->desc->response[i].nl == IZ_RESPONSE_ALL) {
-			iz_exit = cmd->desc->response->call(cmd, ghdr, attrs);
+	if (!nlmsg_get_src(msg)->nl_groups) {
+		req = iz_req_find(nlh->nlmsg_seq);
+		if (req)
+			iz_req_input(req, ghdr, attrs);
+		return 0;
+	}
+
+	/* Confirmations come by multicast: to whoever works on that interface */
+	if (attrs[IEEE802154_ATTR_DEV_NAME])
+		name = nla_get_string(attrs[IEEE802154_ATTR_DEV_NAME]);
+	for (req = iz_inflight; req; req = next) {
+		next = req->next;
+		if (name && req->cmd.iface && !strchr(req->cmd.iface, '%') &&
+		    strcmp(name, req->cmd.iface))
+			continue;
+		iz_req_input(req, ghdr, attrs);
 	}
 
 	return 0;
@@ -314,17 +663,36 @@ static int iz_cb_valid(struct nl_msg *msg, void *arg)
 static int iz_cb_finish(struct nl_msg *msg, void *arg)
 {
 	struct nlmsghdr *nlh = nlmsg_hdr(msg);
-	struct iz_cmd *cmd = arg;
+	struct iz_req *req;
+	iz_res_t res;
 
 	dprintf(1, "Received finish for interface\n");
+	PROBE1(iz, finish, nlh->nlmsg_seq);
 
-	if (cmd->seq == nlh->nlmsg_seq) {
-		if (cmd->desc->finish)
-			iz_exit = cmd->desc->finish(cmd);
-		else
-			iz_exit = IZ_STOP_ERR;
-	}
+	req = iz_req_find(nlh->nlmsg_seq);
+	if (!req)
+		return 0;
+
+	if (req->cmd.desc->finish)
+		res = req->cmd.desc->finish(&req->cmd);
+	else
+		res = IZ_STOP_ERR;
+	if (res != IZ_CONT_OK)
+		iz_req_done(req, res);
 
 	return 0;
 }
 
+/* Callback for an error reply: only the request it answers fails */
+static int iz_cb_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	struct iz_req *req = iz_req_find(err->msg.nlmsg_seq);
+
+	if (!req)
+		return NL_SKIP;
+
+	printf("%s: %s\n", req->cmd.desc->name, strerror(-err->error));
+	iz_req_done(req, IZ_STOP_ERR);
+
+	return NL_SKIP;
+}
@@ -80,6 +80,12 @@ struct iz_cmd {
 
 	const struct iz_cmd_desc *desc;
 
+	/*
+	 * Set in batch mode and with a timeout: the command must not block
+	 * in parse, but go through the kernel like any other request.
+	 */
+	int nonblock;
+
 	/* Fields below are prepared by parse function */
 	int flags;	/* NL message flags */
 	char *iface;	/* Interface for a command */
@@ -0,0 +1,528 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Listen to the IEEE 802.15.4 multicast groups once, on behalf of any
+ * number of local readers: each message is decoded into a fixed record
+ * of a shared memory ring, readers are woken through an eventfd each.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+
+#include <ieee802154.h>
+#include <nl802154.h>
+#include <libcommon.h>
+#include <logging.h>
+#include <izevent.h>
+
+#define IZEVENTD_RECORDS	4096
+#define IZEVENTD_MAX_READERS	64
+/* Bursts of indications must not overrun us while readers are woken */
+#define IZEVENTD_RCVBUF		(1 << 20)
+
+struct reader {
+	int sock;
+	int efd;
+};
+
+static struct izevent_ring *ring;
+static size_t ring_size;
+static int ring_fd = -1;
+static uint64_t woken_head;
+
+static struct reader readers[IZEVENTD_MAX_READERS];
+static int nreaders;
+
+static struct nl_sock *nl;
+static volatile sig_atomic_t stop;
+
+/* Scalar attributes and where they go in a record */
+#define FIELD(attr, f)	{ IEEE802154_ATTR_##attr, offsetof(struct izevent, f), \
+			  sizeof(((struct izevent *)0)->f) }
+
+static const struct {
+	int attr;
+	size_t off;
+	size_t size;
+} fields[] = {
+	FIELD(DEV_INDEX, dev_index),
+	FIELD(STATUS, status),
+	FIELD(SHORT_ADDR, short_addr),
+	FIELD(HW_ADDR, hw_addr),
+	FIELD(PAN_ID, pan_id),
+	FIELD(CHANNEL, channel),
+	FIELD(COORD_SHORT_ADDR, coord_short_addr),
+	FIELD(COORD_HW_ADDR, coord_hw_addr),
+	FIELD(COORD_PAN_ID, coord_pan_id),
+	FIELD(SRC_SHORT_ADDR, src_short_addr),
+	FIELD(SRC_HW_ADDR, src_hw_addr),
+	FIELD(SRC_PAN_ID, src_pan_id),
+	FIELD(DEST_SHORT_ADDR, dest_short_addr),
+	FIELD(DEST_HW_ADDR, dest_hw_addr),
+	FIELD(DEST_PAN_ID, dest_pan_id),
+	FIELD(CAPABILITY, capability),
+	FIELD(REASON, reason),
+	FIELD(SCAN_TYPE, scan_type),
+	FIELD(CHANNELS, channels),
+	FIELD(DURATION, duration),
+	FIELD(BCN_ORD, bcn_ord),
+	FIELD(SF_ORD, sf_ord),
+	FIELD(PAN_COORD, pan_coord),
+	FIELD(BAT_EXT, bat_ext),
+	FIELD(COORD_REALIGN, coord_realign),
+	FIELD(SEC, sec),
+	FIELD(PAGE, page),
+	FIELD(DEV_TYPE, dev_type),
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ring_create(unsigned int nrec)
+{
+	int err;
+
+	ring_size = sizeof(*ring) + (size_t)nrec * sizeof(struct izevent);
+
+	ring_fd = memfd_create("izevent", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (ring_fd < 0)
+		return -errno;
+	if (ftruncate(ring_fd, ring_size)) {
+		err = -errno;
+		close(ring_fd);
+		return err;
+	}
+
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if (ring == MAP_FAILED) {
+		err = -errno;
+		close(ring_fd);
+		return err;
+	}
+
+	memcpy(ring->magic, IZEVENT_MAGIC, sizeof(ring->magic));
+	ring->nrec = nrec;
+	ring->rec_size = sizeof(struct izevent);
+
+	/*
+	 * Readers get this very fd: they must not be able to resize it
+	 * under the others, and where the kernel can, not write it either.
+	 */
+#ifdef F_SEAL_FUTURE_WRITE
+	if (!fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				F_SEAL_FUTURE_WRITE | F_SEAL_SEAL))
+		return 0;
+#endif
+	if (fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+		log_msg(0, "Can't seal the ring: %s\n", strerror(errno));
+
+	return 0;
+}
+
+/* Decoded in place: readers see the slot only once seq is set */
+static int event_cb(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nlh = nlmsg_hdr(msg);
+	struct nlattr *attrs[IEEE802154_ATTR_MAX + 1];
+	struct genlmsghdr *ghdr = nlmsg_data(nlh);
+	uint64_t idx = ring->head;
+	struct izevent *ev = &ring->rec[idx & (ring->nrec - 1)];
+	unsigned int i;
+	int err;
+
+	err = genlmsg_parse(nlh, 0, attrs, IEEE802154_ATTR_MAX, ieee802154_policy);
+	if (err < 0) {
+		log_msg(1, "Dropping malformed command %d: %s\n", ghdr->cmd, nl_geterror(err));
+		return NL_SKIP;
+	}
+
+	__atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memset((char *)ev + sizeof(ev->seq), 0, sizeof(*ev) - sizeof(ev->seq));
+
+	ev->ts = now_ns();
+	ev->cmd = ghdr->cmd;
+	for (i = 0; i <= IEEE802154_ATTR_MAX; i++)
+		if (attrs[i])
+			ev->present |= 1ULL << i;
+
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+		if (attrs[fields[i].attr])
+			memcpy((char *)ev + fields[i].off,
+				nla_data(attrs[fields[i].attr]), fields[i].size);
+	if (attrs[IEEE802154_ATTR_DEV_NAME])
+		nla_strlcpy(ev->dev_name, attrs[IEEE802154_ATTR_DEV_NAME],
+				sizeof(ev->dev_name));
+	if (attrs[IEEE802154_ATTR_PHY_NAME])
+		nla_strlcpy(ev->phy_name, attrs[IEEE802154_ATTR_PHY_NAME],
+				sizeof(ev->phy_name));
+
+	__atomic_store_n(&ev->seq, (uint32_t)(idx + 1), __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, idx + 1, __ATOMIC_RELEASE);
+
+	log_msg(2, "Event %d on %s\n", ev->cmd, ev->dev_name);
+
+	return NL_OK;
+}
+
+static int netlink_open(void)
+{
+	static const char *const groups[] = {
+		IEEE802154_MCAST_COORD_NAME,
+		IEEE802154_MCAST_BEACON_NAME,
+	};
+	unsigned int i;
+	int group, err, joined = 0;
+
+	nl = nl_socket_alloc();
+	if (!nl)
+		return -NLE_NOMEM;
+
+	err = genl_connect(nl);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		group = nl_get_multicast_id(nl, IEEE802154_NL_NAME, groups[i]);
+		if (group < 0)
+			continue;
+		nl_socket_add_membership(nl, group);
+		joined++;
+	}
+	if (!joined)
+		return -NLE_OBJ_NOTFOUND;
+
+	nl_socket_disable_seq_check(nl);
+	nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM, event_cb, NULL);
+	nl_socket_set_buffer_size(nl, IZEVENTD_RCVBUF, 0);
+	nl_socket_set_nonblocking(nl);
+
+	return 0;
+}
+
+static void netlink_read(void)
+{
+	int err;
+
+	while ((err = nl_recvmsgs_default(nl)) >= 0)
+		;
+
+	/* libnl reports ENOBUFS as NLE_NOMEM */
+	if (err == -NLE_NOMEM) {
+		__atomic_fetch_add(&ring->nl_lost, 1, __ATOMIC_RELAXED);
+		log_msg(0, "Events lost, the kernel dropped messages\n");
+	} else if (err != -NLE_AGAIN) {
+		log_msg(0, "Receive failed: %s\n", nl_geterror(err));
+	}
+}
+
+/* One write per reader and batch of messages, not per message */
+static void wake_readers(void)
+{
+	uint64_t one = 1;
+	int i;
+
+	if (ring->head == woken_head)
+		return;
+	woken_head = ring->head;
+
+	for (i = 0; i < nreaders; i++)
+		if (write(readers[i].efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			log_msg(1, "Can't wake reader: %s\n", strerror(errno));
+}
+
+static int send_fds(int sock, int efd)
+{
+	union {
+		struct cmsghdr cm;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} u;
+	int fds[2] = { ring_fd, efd };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	char c = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 ? -errno : 0;
+}
+
+static void reader_accept(int lfd)
+{
+	int sock, efd, err;
+
+	sock = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (sock < 0)
+		return;
+
+	if (nreaders == IZEVENTD_MAX_READERS) {
+		log_msg(0, "Too many readers, turning one away\n");
+		close(sock);
+		return;
+	}
+
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		log_msg(0, "Can't create eventfd: %s\n", strerror(errno));
+		close(sock);
+		return;
+	}
+
+	err = send_fds(sock, efd);
+	if (err < 0) {
+		log_msg(1, "Can't hand out the ring: %s\n", strerror(-err));
+		close(efd);
+		close(sock);
+		return;
+	}
+
+	readers[nreaders].sock = sock;
+	readers[nreaders].efd = efd;
+	nreaders++;
+	log_msg(1, "Reader %d connected, %d in all\n", sock, nreaders);
+}
+
+static void reader_drop(int i)
+{
+	log_msg(1, "Reader %d gone\n", readers[i].sock);
+	close(readers[i].sock);
+	close(readers[i].efd);
+	readers[i] = readers[--nreaders];
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path))
+		return -ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(fd, 16) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static void stop_handler(int sig)
+{
+	stop = 1;
+}
+
+static void run(int lfd)
+{
+	struct pollfd pfd[2 + IZEVENTD_MAX_READERS];
+	int i, n;
+
+	while (!stop) {
+		pfd[0].fd = nl_socket_get_fd(nl);
+		pfd[0].events = POLLIN;
+		pfd[1].fd = lfd;
+		pfd[1].events = POLLIN;
+		/* Readers never talk to us, we only wait for them to hang up */
+		for (i = 0; i < nreaders; i++) {
+			pfd[2 + i].fd = readers[i].sock;
+			pfd[2 + i].events = POLLIN;
+		}
+		n = nreaders;
+
+		if (poll(pfd, 2 + n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_msg(0, "poll: %s\n", strerror(errno));
+			return;
+		}
+
+		if (pfd[0].revents) {
+			netlink_read();
+			wake_readers();
+		}
+
+		for (i = n - 1; i >= 0; i--)
+			if (pfd[2 + i].revents)
+				reader_drop(i);
+
+		if (pfd[1].revents & POLLIN)
+			reader_accept(lfd);
+	}
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option long_options[] = {
+	{"help", 0, 0, 'h'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+#endif
+
+static void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n", name);
+	printf("Listen to IEEE 802.15.4 events once, for all local readers.\n\n");
+	printf(	" -S socket          Where readers connect to get the event ring.\n"
+		" -n records         Size of the ring, a power of two (default %u).\n"
+		" -d debug_level     Set debug level of application.\n"
+		"                    Will not demonize on levels > 0.\n"
+		" -h, --help         This usage information.\n"
+		" -v, --version      Print version information.\n",
+		IZEVENTD_RECORDS);
+
+	printf("\n");
+	printf("Report bugs to " PACKAGE_BUGREPORT "\n\n");
+	printf(PACKAGE_NAME " homepage <" PACKAGE_URL ">\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = EVENT_SOCKET;
+	unsigned long nrec = IZEVENTD_RECORDS;
+	struct sigaction sa;
+	int debug = 0, opt, lfd, err, i;
+
+	while (1) {
+#ifdef HAVE_GETOPT_LONG
+		int option_index = 0;
+		opt = getopt_long(argc, argv, "S:n:d:hv", long_options, &option_index);
+#else
+		opt = getopt(argc, argv, "S:n:d:hv");
+#endif
+		if (opt == -1)
+			break;
+
+		switch (opt) {
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'n':
+			nrec = strtoul(optarg, NULL, 0);
+			if (!nrec || (nrec & (nrec - 1)) || nrec > (1UL << 24)) {
+				fprintf(stderr, "Bad ring size: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			debug = atoi(optarg);
+			break;
+		case 'v':
+			printf("izeventd " VERSION "\n");
+			return 0;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	init_log(basename(argv[0]), debug);
+
+	err = netlink_open();
+	if (err < 0) {
+		fprintf(stderr, "Can't listen to %s events: %s\n",
+				IEEE802154_NL_NAME, nl_geterror(err));
+		return 1;
+	}
+
+	err = ring_create(nrec);
+	if (err < 0) {
+		fprintf(stderr, "Can't create the ring: %s\n", strerror(-err));
+		return 1;
+	}
+
+	lfd = listen_on(socket_path);
+	if (lfd < 0) {
+		fprintf(stderr, "Can't listen on %s: %s\n", socket_path, strerror(-lfd));
+		return 1;
+	}
+
+	if (debug <= 0 && daemon(0, 0) < 0) {
+		perror("daemon");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	log_msg(0, "Serving %lu records on %s\n", nrec, socket_path);
+	run(lfd);
+
+	for (i = nreaders - 1; i >= 0; i--)
+		reader_drop(i);
+	close(lfd);
+	unlink(socket_path);
+	nl_socket_free(nl);
+
+	return 0;
+}
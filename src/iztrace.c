@@ -0,0 +1,206 @@
+/*
+ * Linux IEEE 802.15.4 userspace tools
+ *
+ * Decoder for the izcoordinator binary event trace.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#include "coord-trace.h"
+
+static const char *event_names[__TRACE_MAX] = {
+	[TRACE_NONE] = "none",
+	[TRACE_NL_RECV] = "nl_recv",
+	[TRACE_NL_SEND] = "nl_send",
+	[TRACE_ASSOC_INDIC] = "assoc_indic",
+	[TRACE_ASSOC_RESP] = "assoc_resp",
+	[TRACE_DISASSOC_INDIC] = "disassoc_indic",
+	[TRACE_RATELIMIT] = "ratelimit",
+	[TRACE_ALLOC] = "alloc",
+	[TRACE_LEASE_ADD] = "lease_add",
+	[TRACE_LEASE_REFRESH] = "lease_refresh",
+	[TRACE_LEASE_DEL] = "lease_del",
+	[TRACE_FLUSH_START] = "flush_start",
+	[TRACE_FLUSH_END] = "flush_end",
+	[TRACE_START_REQ] = "start_req",
+	[TRACE_START_CONF] = "start_conf",
+	[TRACE_ORPHAN_INDIC] = "orphan_indic",
+	[TRACE_ORPHAN_RESP] = "orphan_resp",
+	[TRACE_COMM_STATUS] = "comm_status",
+	[TRACE_ASSOC_ROLLBACK] = "assoc_rollback",
+	[TRACE_ASSOC_DUP] = "assoc_dup",
+	[TRACE_ACL_DENY] = "acl_deny",
+	[TRACE_LINK] = "link",
+	[TRACE_GTS] = "gts",
+	[TRACE_INDIRECT_SEND] = "indirect_send",
+	[TRACE_INDIRECT_EXPIRE] = "indirect_expire",
+	[TRACE_INDIRECT_OVERFLOW] = "indirect_overflow",
+};
+
+#ifdef HAVE_GETOPT_LONG
+static const struct option iztrace_long_opts[] = {
+	{ "count", required_argument, NULL, 'n' },
+	{ "version", no_argument, NULL, 'v' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+#endif
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] trace_file\n", name);
+	printf("Print the events recorded by izcoordinator -T, oldest first.\n\n");
+	printf("  -n, --count N       only print the last N events\n");
+	printf("  -v, --version       print version\n");
+	printf("  -h, --help          print help\n");
+	printf("\n");
+	printf("Report bugs to " PACKAGE_BUGREPORT "\n\n");
+	printf(PACKAGE_NAME " homepage <" PACKAGE_URL ">\n");
+}
+
+static void print_rec(const struct coord_trace_hdr *hdr,
+		const struct coord_trace_rec *r)
+{
+	int64_t wall = (int64_t)r->ts + hdr->realtime_offset;
+	time_t sec = wall / 1000000000LL;
+	const char *name = "unknown";
+	char stamp[32];
+	struct tm tm;
+	int i;
+
+	localtime_r(&sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+	if (r->event < __TRACE_MAX && event_names[r->event])
+		name = event_names[r->event];
+
+	printf("%s.%06lld %-15s ", stamp,
+			(long long)(wall % 1000000000LL) / 1000, name);
+	for (i = 0; i < 8; i++)
+		printf("%02x%c", r->hwaddr[i], i == 7 ? ' ' : ':');
+	printf("%04x %u %d\n", r->short_addr, r->arg, (int32_t)r->arg2);
+}
+
+int main(int argc, char **argv)
+{
+	const struct coord_trace_hdr *hdr;
+	unsigned long count = 0;
+	uint64_t head, first, i;
+	unsigned long skipped = 0;
+	struct stat st;
+	int fd, opt;
+
+	while (1) {
+#ifdef HAVE_GETOPT_LONG
+		opt = getopt_long(argc, argv, "n:vh", iztrace_long_opts, NULL);
+#else
+		opt = getopt(argc, argv, "n:vh");
+#endif
+		if (opt == -1)
+			break;
+
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			printf(	"iztrace " VERSION "\n"
+				"License GPLv2 GNU GPL version 2 <http://gnu.org/licenses/gpl.html>.\n"
+				"This is free software: you are free to change and redistribute it.\n"
+				"There is NO WARRANTY, to the extent permitted by law.\n");
+			return 0;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (st.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "%s: too short for a trace\n", argv[optind]);
+		return 1;
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (memcmp(hdr->magic, COORD_TRACE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->rec_size != sizeof(struct coord_trace_rec) ||
+	    !hdr->nrec || (hdr->nrec & (hdr->nrec - 1)) ||
+	    st.st_size < (off_t)(sizeof(*hdr) + (uint64_t)hdr->nrec * hdr->rec_size)) {
+		fprintf(stderr, "%s: not an izcoordinator trace\n", argv[optind]);
+		return 1;
+	}
+
+	/* The coordinator may still be writing, take one snapshot of head */
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	first = head > hdr->nrec ? head - hdr->nrec : 0;
+	if (count && head - first > count)
+		first = head - count;
+
+	for (i = first; i < head; i++) {
+		const struct coord_trace_rec *r = &hdr->rec[i & (hdr->nrec - 1)];
+		struct coord_trace_rec copy;
+
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != (uint32_t)(i + 1)) {
+			skipped++;
+			continue;
+		}
+		memcpy(&copy, r, sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		/* Overwritten while we were copying it */
+		if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != (uint32_t)(i + 1)) {
+			skipped++;
+			continue;
+		}
+		print_rec(hdr, &copy);
+	}
+
+	if (skipped)
+		fprintf(stderr, "%lu incomplete or overwritten records skipped\n", skipped);
+
+	return 0;
+}